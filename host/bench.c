@@ -0,0 +1,261 @@
+#include "host.h"
+#include <learnix/kheap.h>
+#include <learnix/slab.h>
+#include <learnix/vm.h>
+#include <learnix/vmalloc.h>
+#include <learnix/x86/x86.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+* allocation pattern benchmarks of the hosted memory manager:
+* ops/sec, latency percentiles in TSC cycles and, for the heap,
+* fragmentation over time. Latencies include the SIGSEGV round
+* trips of host.c that stand in for TLB misses and page faults
+*
+* usage: bench [ops] [ram_mb]
+*/
+
+// live allocations of the random patterns
+#define BENCH_SLOTS 1024
+
+// fragmentation samples of the random heap pattern
+#define BENCH_FRAG_SAMPLES 10
+
+static uint32_t* bench_cycles;
+static uint32_t bench_ops;
+static uint64_t bench_seed = 0x9E3779B97F4A7C15ull;
+
+// xorshift64, deterministic across runs
+static uint32_t
+bench_rand()
+{
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 7;
+	bench_seed ^= bench_seed << 17;
+	return (uint32_t)bench_seed;
+}
+
+static double
+bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+bench_cmp(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// prints throughput and latency percentiles of the
+// n operations recorded in bench_cycles[]
+static void
+bench_report(const char* name, uint32_t n, double seconds)
+{
+	qsort(bench_cycles, n, sizeof(*bench_cycles), bench_cmp);
+	printf("%-28s %10.0f ops/s  p50 %6u  p90 %6u  p99 %7u  p99.9 %8u  "
+	       "max %9u cycles\n",
+	       name, n / seconds, bench_cycles[n / 2], bench_cycles[n * 9 / 10],
+	       bench_cycles[n * 99 / 100], bench_cycles[n * 999 / 1000],
+	       bench_cycles[n - 1]);
+}
+
+// records the latency of a single operation
+#define BENCH_OP(i, op)                                                        \
+	do                                                                     \
+	{                                                                      \
+		uint64_t tsc = read_tsc();                                     \
+		op;                                                            \
+		bench_cycles[i] = read_tsc() - tsc;                            \
+	} while (0)
+
+static void
+bench_kmalloc_lifo()
+{
+	double start = bench_now();
+
+	// allocate and free right away: always the same chunk
+	for (uint32_t i = 0; i < bench_ops; i += 2)
+	{
+		void* ptr;
+		BENCH_OP(i, ptr = kmalloc(64));
+		BENCH_OP(i + 1, kfree(ptr));
+	}
+	bench_report("kmalloc/kfree 64 B lifo", bench_ops & ~1u,
+	             bench_now() - start);
+}
+
+static void
+bench_kmalloc_random()
+{
+	static void* slots[BENCH_SLOTS];
+	kheap_frag_t frag;
+	double start = bench_now();
+
+	// random sizes, random frees: the live set hovers
+	// around BENCH_SLOTS / 2 allocations
+	printf("\nkheap fragmentation, random sizes 16 B - 4 KB:\n");
+	for (uint32_t i = 0; i < bench_ops; i++)
+	{
+		uint32_t slot = bench_rand() % BENCH_SLOTS;
+		if (slots[slot] != NULL)
+		{
+			BENCH_OP(i, kfree(slots[slot]));
+			slots[slot] = NULL;
+		}
+		else
+		{
+			uint32_t size = 16 << (bench_rand() % 9);
+			size += bench_rand() % size;
+			BENCH_OP(i, slots[slot] = kmalloc(size));
+		}
+
+		if ((i + 1) % (bench_ops / BENCH_FRAG_SAMPLES) == 0)
+		{
+			kheap_fragmentation(&frag);
+			// same measure as dbg_print_kheap_profile()
+			uint32_t percent = frag.free_bytes
+			                       ? 100 - (uint64_t)frag.largest_free * 100
+			                                   / frag.free_bytes
+			                       : 0;
+			printf("  ops %8u: heap %8u B, free %8u B in %5u chunks, "
+			       "largest %8u B, fragmentation %3u%%\n",
+			       i + 1, frag.heap_bytes, frag.free_bytes,
+			       frag.free_chunks, frag.largest_free, percent);
+		}
+	}
+	double seconds = bench_now() - start;
+
+	for (uint32_t slot = 0; slot < BENCH_SLOTS; slot++)
+		kfree(slots[slot]);
+	if (kheap_check() < 0)
+		panic("bench: corrupted heap");
+	bench_report("kmalloc/kfree random", bench_ops, seconds);
+}
+
+static void
+bench_krealloc()
+{
+	uint32_t n = 0;
+	double start = bench_now();
+
+	// a buffer that keeps growing, like a vector
+	while (n < bench_ops)
+	{
+		void* ptr = NULL;
+		for (uint32_t size = 16; size <= 64 * 1024 && n < bench_ops;
+		     size += size / 2, n++)
+			BENCH_OP(n, ptr = krealloc(ptr, size));
+		kfree(ptr);
+	}
+	bench_report("krealloc growth", n, bench_now() - start);
+}
+
+static void
+bench_kmem_cache()
+{
+	static void* slots[BENCH_SLOTS];
+	kmem_cache_t* cache = kmem_cache_create("bench", 64, 0, NULL);
+	double start = bench_now();
+
+	for (uint32_t i = 0; i < bench_ops; i++)
+	{
+		uint32_t slot = bench_rand() % BENCH_SLOTS;
+		if (slots[slot] != NULL)
+		{
+			BENCH_OP(i, kmem_cache_free(cache, slots[slot]));
+			slots[slot] = NULL;
+		}
+		else
+			BENCH_OP(i, slots[slot] = kmem_cache_alloc(cache));
+	}
+	double seconds = bench_now() - start;
+
+	for (uint32_t slot = 0; slot < BENCH_SLOTS; slot++)
+	{
+		if (slots[slot] != NULL)
+			kmem_cache_free(cache, slots[slot]);
+	}
+	bench_report("kmem_cache 64 B random", bench_ops, seconds);
+}
+
+static void
+bench_page_alloc(uint32_t order)
+{
+	static physical_page_metadata_t* slots[BENCH_SLOTS / 4];
+	char name[32];
+	double start = bench_now();
+
+	for (uint32_t i = 0; i < bench_ops; i++)
+	{
+		uint32_t slot = bench_rand() % (BENCH_SLOTS / 4);
+		if (slots[slot] != NULL)
+		{
+			BENCH_OP(i, page_free_order(slots[slot], order));
+			slots[slot] = NULL;
+		}
+		else
+			BENCH_OP(i, slots[slot] = page_alloc_order(order));
+	}
+	double seconds = bench_now() - start;
+
+	for (uint32_t slot = 0; slot < BENCH_SLOTS / 4; slot++)
+	{
+		if (slots[slot] != NULL)
+			page_free_order(slots[slot], order);
+	}
+	snprintf(name, sizeof(name), "page_alloc order %u random", order);
+	bench_report(name, bench_ops, seconds);
+}
+
+static void
+bench_vmalloc()
+{
+	uint32_t n = bench_ops / 64;
+	double start = bench_now();
+
+	// reserve, fault in 4 of the 16 pages, give everything back
+	for (uint32_t i = 0; i < n; i++)
+	{
+		BENCH_OP(i, {
+			volatile char* buf = vmalloc(16 * PGSIZE);
+			for (uint32_t j = 0; j < 16; j += 4)
+				buf[j * PGSIZE] = 1;
+			vfree((void*)buf);
+		});
+	}
+	bench_report("vmalloc/touch 4/vfree", n, bench_now() - start);
+}
+
+int
+main(int argc, char** argv)
+{
+	bench_ops = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	if (bench_ops < 64 * BENCH_FRAG_SAMPLES)
+		bench_ops = 64 * BENCH_FRAG_SAMPLES;
+	bench_cycles = malloc(bench_ops * sizeof(*bench_cycles));
+	if (bench_cycles == NULL)
+		return 1;
+
+	host_boot(argc > 2 ? strtoul(argv[2], NULL, 0) : HOST_RAM_MB);
+	printf("\n== BENCH: %u ops per pattern, %u MB of RAM ==\n", bench_ops,
+	       (uint32_t)(host_ram_size >> 20));
+
+	bench_kmalloc_lifo();
+	bench_kmalloc_random();
+	printf("\n");
+	bench_krealloc();
+	bench_kmem_cache();
+	bench_page_alloc(0);
+	bench_page_alloc(3);
+	bench_vmalloc();
+	printf("\nsoftware TLB fills: %lu\n", (unsigned long)host_tlb_fills);
+	return 0;
+}
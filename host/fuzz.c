@@ -0,0 +1,233 @@
+#include "host.h"
+#include <learnix/kheap.h>
+#include <learnix/vm.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* libFuzzer harness of the kernel heap: every 4 bytes of the
+* input are an operation on one of FUZZ_SLOTS allocations.
+* Allocations are filled with a pattern that is checked before
+* they are freed or resized, kheap_check() runs after every
+* operation and the heap must use as many bytes as after boot
+* once everything is freed
+*
+* built with -DFUZZ_MAIN it is a standalone program that runs
+* the inputs given as files, or random ones without arguments
+*/
+
+#define FUZZ_SLOTS 64
+
+// enough for every slot to hold the largest allocation
+#define FUZZ_RAM_MB 256
+
+enum
+{
+	FUZZ_KMALLOC,
+	FUZZ_KFREE,
+	FUZZ_KREALLOC,
+	FUZZ_KMALLOC_ALIGNED,
+	FUZZ_KCALLOC,
+	FUZZ_NOPS
+};
+
+typedef struct
+{
+	uint8_t* ptr;
+	uint32_t size;
+	uint8_t fill;
+} fuzz_slot_t;
+
+static fuzz_slot_t fuzz_slots[FUZZ_SLOTS];
+
+// bytes in use after boot, kheap_test() leaves some allocations
+static uint32_t fuzz_used_bytes;
+
+static void
+fuzz_fail(const char* what, uint32_t slot)
+{
+	fprintf(stderr, "[FUZZ] %s, slot %u\n", what, slot);
+	dbg_print_kheap();
+	abort();
+}
+
+static void
+fuzz_fill(fuzz_slot_t* s, uint8_t fill)
+{
+	s->fill = fill;
+	memset(s->ptr, fill, s->size);
+}
+
+// checks that the first n bytes of the slot still hold its pattern
+static void
+fuzz_verify(fuzz_slot_t* s, uint32_t n, uint32_t slot)
+{
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (s->ptr[i] != s->fill)
+			fuzz_fail("allocation overwritten", slot);
+	}
+}
+
+static void
+fuzz_release(fuzz_slot_t* s, uint32_t slot)
+{
+	if (s->ptr == NULL)
+		return;
+	fuzz_verify(s, s->size, slot);
+	kfree(s->ptr);
+	s->ptr = NULL;
+}
+
+int
+LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+	kheap_frag_t frag;
+
+	(void)argc;
+	(void)argv;
+	host_boot(FUZZ_RAM_MB);
+	kheap_fragmentation(&frag);
+	fuzz_used_bytes = frag.heap_bytes - frag.free_bytes;
+	return 0;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	kheap_frag_t frag;
+
+	for (size_t i = 0; i + 4 <= size; i += 4)
+	{
+		uint32_t op = data[i] % FUZZ_NOPS;
+		uint32_t slot = data[i + 1] % FUZZ_SLOTS;
+		// the top bit of the opcode scales the size up to 1 MB
+		uint32_t n = data[i + 2] | data[i + 3] << 8;
+		if (data[i] & 0x80)
+			n <<= 4;
+
+		fuzz_slot_t* s = &fuzz_slots[slot];
+		uint8_t* ptr;
+		switch (op)
+		{
+		case FUZZ_KMALLOC:
+			fuzz_release(s, slot);
+			if ((s->ptr = kmalloc(n)) != NULL)
+			{
+				s->size = n;
+				fuzz_fill(s, data[i]);
+			}
+			break;
+		case FUZZ_KFREE:
+			fuzz_release(s, slot);
+			break;
+		case FUZZ_KREALLOC:
+			// on failure the old allocation is untouched
+			ptr = krealloc(s->ptr, n);
+			if (ptr == NULL && n != 0)
+				break;
+
+			// the old bytes must survive a move
+			uint32_t keep = n < s->size ? n : s->size;
+			if (s->ptr != NULL && ptr != NULL)
+			{
+				s->ptr = ptr;
+				fuzz_verify(s, keep, slot);
+			}
+			s->ptr = ptr;
+			if (ptr != NULL)
+			{
+				s->size = n;
+				fuzz_fill(s, data[i]);
+			}
+			break;
+		case FUZZ_KMALLOC_ALIGNED:
+			fuzz_release(s, slot);
+			uint32_t align = 1u << (data[i + 3] % 13);
+			if ((s->ptr = kmalloc_aligned(n & 0xFFF, align)) != NULL)
+			{
+				if ((uintptr_t)s->ptr & (align - 1))
+					fuzz_fail("misaligned allocation", slot);
+				s->size = n & 0xFFF;
+				fuzz_fill(s, data[i]);
+			}
+			break;
+		case FUZZ_KCALLOC:
+			fuzz_release(s, slot);
+			n &= 0xFFFF;
+			if ((s->ptr = kcalloc(n, data[i + 3] % 8)) != NULL)
+			{
+				s->size = n * (data[i + 3] % 8);
+				s->fill = 0;
+				fuzz_verify(s, s->size, slot);
+				fuzz_fill(s, data[i]);
+			}
+			break;
+		}
+
+		if (kheap_check() < 0)
+			fuzz_fail("heap check failed", slot);
+	}
+
+	// nothing leaks, and kheap_check() makes
+	// sure every free chunk merged back
+	for (uint32_t slot = 0; slot < FUZZ_SLOTS; slot++)
+		fuzz_release(&fuzz_slots[slot], slot);
+	kheap_fragmentation(&frag);
+	if (kheap_check() < 0
+	    || frag.heap_bytes - frag.free_bytes != fuzz_used_bytes)
+		fuzz_fail("heap not empty", FUZZ_SLOTS);
+	return 0;
+}
+
+#ifdef FUZZ_MAIN
+// xorshift64, deterministic across runs
+static uint64_t fuzz_seed = 0x2545F4914F6CDD1Dull;
+
+static uint8_t
+fuzz_rand()
+{
+	fuzz_seed ^= fuzz_seed << 13;
+	fuzz_seed ^= fuzz_seed >> 7;
+	fuzz_seed ^= fuzz_seed << 17;
+	return (uint8_t)fuzz_seed;
+}
+
+int
+main(int argc, char** argv)
+{
+	static uint8_t input[4096];
+
+	LLVMFuzzerInitialize(&argc, &argv);
+
+	// replay the given inputs
+	for (int i = 1; i < argc; i++)
+	{
+		FILE* f = fopen(argv[i], "rb");
+		if (f == NULL)
+		{
+			perror(argv[i]);
+			return 1;
+		}
+		size_t n = fread(input, 1, sizeof(input), f);
+		fclose(f);
+		LLVMFuzzerTestOneInput(input, n);
+	}
+	if (argc > 1)
+		return 0;
+
+	// or run random ones
+	for (uint32_t run = 0; run < 500; run++)
+	{
+		size_t n = fuzz_rand() * 4 * (1 + fuzz_rand() % 4);
+		for (size_t i = 0; i < n; i++)
+			input[i] = fuzz_rand();
+		LLVMFuzzerTestOneInput(input, n);
+	}
+	printf("[FUZZ] 500 random inputs passed\n");
+	return 0;
+}
+#endif
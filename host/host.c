@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include "host.h"
+#include <learnix/cpu.h>
+#include <learnix/fpu.h>
+#include <learnix/multiboot.h>
+#include <learnix/vm.h>
+#include <learnix/x86/mmu.h>
+#include <learnix/x86/x86.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// size of the kernel window, from KERN_BASE_VRT to 4 GB
+#define HOST_WINDOW_SIZE (PHYS_MEM_LIMIT - KERN_BASE_VRT)
+
+#ifdef __x86_64__
+#define HOST_REG_IP REG_RIP
+#else
+#define HOST_REG_IP REG_EIP
+#endif
+
+uint32_t host_cr3, host_cr4, host_eflags = HOST_FL_IF;
+
+// the software MMU implements both large and global pages
+uint32_t cpu_features = CPU_FEATURE_PSE | CPU_FEATURE_PGE;
+
+// the host saves the SSE registers itself, the
+// kernel_fpu_begin() sections are no-ops
+int fpu_ready = 1;
+
+void
+kernel_fpu_begin()
+{
+}
+
+void
+kernel_fpu_end()
+{
+}
+
+uint8_t* host_ram;
+uint64_t host_ram_size;
+uint64_t host_tlb_fills;
+
+// backs host_ram and every page mapped in the kernel window
+static int host_ram_fd = -1;
+
+// kernel logs are only printed on request
+static int host_verbose;
+
+void
+panic(const char* reason)
+{
+	fprintf(stderr, "[PANIC] %s\n", reason);
+	abort();
+}
+
+void
+serial_printf(const char* format, ...)
+{
+	va_list ap;
+
+	if (!host_verbose)
+		return;
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+void
+host_tlb_flush(uintptr_t va, uint32_t npages)
+{
+	// an inaccessible page faults again on the next access,
+	// which walks the page tables like a TLB miss would
+	if (mmap((void*)va, (size_t)npages * PGSIZE, PROT_NONE,
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0)
+	    == MAP_FAILED)
+		panic("host_tlb_flush: mmap failed");
+}
+
+void
+host_tlb_flush_all(void)
+{
+	host_tlb_flush(KERN_BASE_VRT, HOST_WINDOW_SIZE / PGSIZE);
+}
+
+// walks the current page directory through host_ram, as the
+// MMU does on a TLB miss, returns -1 if va isn't mapped
+static int
+host_walk(uintptr_t va, physaddr_t* pa)
+{
+	pde_t pde = ((pde_t*)(host_ram + host_cr3))[PDX(va)];
+
+	if (!(pde & PTE_P))
+		return -1;
+	if ((pde & PTE_PS) && (host_cr4 & CR4_PSE))
+	{
+		*pa = LGPTE_ADDR(pde) | (LGPGOFFSET(va) & ~(PGSIZE - 1));
+		return 0;
+	}
+
+	pte_t pte = ((pte_t*)(host_ram + PTE_ADDR(pde)))[PTX(va)];
+	if (!(pte & PTE_P))
+		return -1;
+	*pa = PTE_ADDR(pte);
+	return 0;
+}
+
+// maps the page of va to the frame at pa, always writable:
+// boot.S sets CR0.WP but PTE_W isn't checked, which is only
+// right as long as the kernel maps all of its pages writable
+static void
+host_tlb_fill(uintptr_t va, physaddr_t pa)
+{
+	if (pa + PGSIZE > host_ram_size)
+	{
+		fprintf(stderr, "[HOST] %lx maps %x, outside of the RAM\n",
+		        (unsigned long)va, pa);
+		abort();
+	}
+	if (mmap((void*)PGROUNDDOWN(va), PGSIZE, PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED, host_ram_fd, pa)
+	    == MAP_FAILED)
+		panic("host_tlb_fill: mmap failed");
+	host_tlb_fills++;
+}
+
+// SIGSEGV handler: a TLB miss if the page tables map the address,
+// a page fault for the kernel otherwise
+static void
+host_fault(int sig, siginfo_t* info, void* ctx)
+{
+	uintptr_t va = (uintptr_t)info->si_addr;
+	ucontext_t* uc = ctx;
+	physaddr_t pa;
+
+	(void)sig;
+	if ((uint64_t)va >= KERN_BASE_VRT && (uint64_t)va < PHYS_MEM_LIMIT)
+	{
+		if (host_walk(va, &pa) == 0)
+		{
+			host_tlb_fill(va, pa);
+			return;
+		}
+
+		// same error code the CPU pushes for a kernel
+		// access to a page that isn't present
+		uint32_t error_code = uc->uc_mcontext.gregs[REG_ERR] & FEC_WR;
+		if (vm_page_fault(va, error_code) == 0 && host_walk(va, &pa) == 0)
+		{
+			host_tlb_fill(va, pa);
+			return;
+		}
+	}
+
+	// symbolize with addr2line -e <binary>
+	void* trace[32];
+	fprintf(stderr, "[HOST] page fault at %lx, ip %lx\n", (unsigned long)va,
+	        (unsigned long)uc->uc_mcontext.gregs[HOST_REG_IP]);
+	backtrace_symbols_fd(trace, backtrace(trace, 32), 2);
+	abort();
+}
+
+// what boot.S does before kernel_main(): the boot page
+// table maps the first 4 MB of RAM at KERN_BASE_VRT
+static void
+host_boot_pgdir()
+{
+	pde_t* pgdir = (pde_t*)(host_ram + HOST_PGDIR_PA);
+	pte_t* pgtable = (pte_t*)(host_ram + HOST_PGDIR_PA + PGSIZE);
+
+	for (uint32_t i = 0; i < NPTENTRIES; i++)
+		pgtable[i] = (i << PTXSHIFT) | PTE_P | PTE_W;
+	pgdir[PDX(KERN_BASE_VRT)] = (HOST_PGDIR_PA + PGSIZE) | PTE_P | PTE_W;
+	host_cr3 = HOST_PGDIR_PA;
+}
+
+// what GRUB hands over: a PC memory map with
+// the usual holes below 1 MB
+static multiboot_info_t*
+host_boot_mbi()
+{
+	multiboot_info_t* mbi = (multiboot_info_t*)(host_ram + HOST_MBI_PA);
+	multiboot_memory_map_t* mmap = (multiboot_memory_map_t*)(mbi + 1);
+	uint64_t map[4][3] = {
+		{ 0, HOST_MBI_PA, MULTIBOOT_MEMORY_AVAILABLE },
+		{ HOST_MBI_PA, 0xA0000 - HOST_MBI_PA, MULTIBOOT_MEMORY_RESERVED },
+		{ 0xF0000, 0x10000, MULTIBOOT_MEMORY_RESERVED },
+		{ EXT_MEM_BASE, host_ram_size - EXT_MEM_BASE,
+		  MULTIBOOT_MEMORY_AVAILABLE },
+	};
+
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		mmap[i].size = sizeof(mmap[i]) - sizeof(mmap[i].size);
+		mmap[i].addr = map[i][0];
+		mmap[i].len = map[i][1];
+		mmap[i].type = map[i][2];
+	}
+	mbi->flags = MULTIBOOT_INFO_MEM_MAP;
+	mbi->mmap_addr = HOST_MBI_PA + sizeof(*mbi);
+	mbi->mmap_length = 4 * sizeof(*mmap);
+	return mbi;
+}
+
+void
+host_boot(uint32_t ram_mb)
+{
+	struct sigaction sa;
+
+	host_verbose = getenv("LEARNIX_HOST_VERBOSE") != NULL;
+	host_ram_size = (uint64_t)ram_mb << 20;
+	if (host_ram_size < 8 << 20 || host_ram_size > PHYS_MEM_LIMIT - (1 << 30))
+		panic("host_boot: RAM must be between 8 MB and 3 GB");
+
+	// the RAM is sparse: frames get host memory when first written
+	host_ram_fd = memfd_create("learnix-ram", 0);
+	if (host_ram_fd < 0 || ftruncate(host_ram_fd, host_ram_size) < 0)
+		panic("host_boot: can't create the RAM");
+	host_ram = mmap(NULL, host_ram_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                host_ram_fd, 0);
+	if (host_ram == MAP_FAILED)
+		panic("host_boot: can't map the RAM");
+
+	// the kernel window must not be used by the host process
+	if (mmap((void*)KERN_BASE_VRT, HOST_WINDOW_SIZE, PROT_NONE,
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+	         -1, 0)
+	    != (void*)KERN_BASE_VRT)
+		panic("host_boot: the kernel window is taken");
+
+	// faults nest when the handler touches
+	// pages that aren't mapped yet
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = host_fault;
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, NULL);
+
+	host_boot_pgdir();
+	vm_setup(host_boot_mbi());
+}
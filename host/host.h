@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* NOTE: hosted build of the memory manager (vm, buddy allocator,
+* kheap, slab caches, vmalloc and arenas) as a Linux program, for
+* benchmarks and fuzzing. The kernel sources are compiled as they
+* are, host/include only replaces the privileged instructions
+*
+* physical memory is a memfd of host_ram_size bytes and the kernel
+* window [KERN_BASE_VRT, 4 GB) of the process plays the TLB: pages
+* are mapped on the first access by walking the kernel page tables
+* in the SIGSEGV handler, which calls vm_page_fault() when the page
+* isn't present, and invlpg() or a CR3 reload unmap them again
+*
+* INTERFACE:
+* void host_boot(uint32_t ram_mb)
+*/
+
+// default size of the emulated RAM
+#define HOST_RAM_MB 64
+
+// physical layout set up by host_boot(), as boot.S and GRUB would:
+// boot_page_directory and boot_page_table1 are the "kernel image"
+// (see the --defsym flags in the Makefile), the multiboot info and
+// memory map sit in the reserved EBDA below 640 KB
+#define HOST_PGDIR_PA 0x00200000
+#define HOST_MBI_PA 0x0009FC00
+
+// the whole emulated RAM, outside the kernel window
+extern uint8_t* host_ram;
+extern uint64_t host_ram_size;
+
+// host mappings made by the SIGSEGV handler
+extern uint64_t host_tlb_fills;
+
+// creates ram_mb MB of RAM, reserves the kernel window
+// and runs vm_setup() with a fake multiboot memory map,
+// kernel logs go to stderr if LEARNIX_HOST_VERBOSE is set
+void
+host_boot(uint32_t ram_mb);
@@ -0,0 +1,106 @@
+#ifndef X86_H
+#define X86_H
+
+#include <learnix/x86/mmu.h>
+#include <stdint.h>
+
+/*
+* NOTE: hosted replacement of include/learnix/x86/x86.h, only
+* the instructions used by the memory manager are provided:
+* control registers and EFLAGS are plain variables and the
+* TLB is the set of kernel window pages mapped by host/host.c
+*/
+
+// EFLAGS interrupt enable flag
+#define HOST_FL_IF 0x00000200
+
+extern uint32_t host_cr3, host_cr4, host_eflags;
+
+// drops the host mappings of npages pages starting at va
+void
+host_tlb_flush(uintptr_t va, uint32_t npages);
+
+// drops every host mapping of the kernel window
+void
+host_tlb_flush_all(void);
+
+static inline void
+invlpg(void *addr)
+{
+	host_tlb_flush((uintptr_t)addr, 1);
+}
+
+static inline void
+lcr3(uint32_t val)
+{
+	host_cr3 = val;
+	host_tlb_flush_all();
+}
+
+static inline uint32_t
+rcr3(void)
+{
+	return host_cr3;
+}
+
+static inline void
+lcr4(uint32_t val)
+{
+	host_cr4 = val;
+}
+
+static inline uint32_t
+rcr4(void)
+{
+	return host_cr4;
+}
+
+static inline void
+tlbflush(void)
+{
+	host_tlb_flush_all();
+}
+
+static inline void
+tlbflush_all(void)
+{
+	host_tlb_flush_all();
+}
+
+static inline void
+invpcid_flush_all(void)
+{
+	host_tlb_flush_all();
+}
+
+static inline uint32_t
+read_eflags(void)
+{
+	return host_eflags;
+}
+
+static inline void
+write_eflags(uint32_t eflags)
+{
+	host_eflags = eflags;
+}
+
+static inline void
+cli(void)
+{
+	host_eflags &= ~HOST_FL_IF;
+}
+
+static inline void
+sti(void)
+{
+	host_eflags |= HOST_FL_IF;
+}
+
+static inline uint64_t
+read_tsc(void)
+{
+	return __builtin_ia32_rdtsc();
+}
+
+#endif /* ! X86_H */
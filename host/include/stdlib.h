@@ -0,0 +1,7 @@
+#pragma once
+
+// the host C library plus the kernel's panic()
+#include_next <stdlib.h>
+
+/// prints the reason and then aborts the process
+void panic(const char* reason);
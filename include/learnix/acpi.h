@@ -0,0 +1,109 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <learnix/vm.h>
+#include <stdint.h>
+
+/*
+    SOURCES:
+    - https://uefi.org/specs/ACPI/6.5/05_ACPI_Software_Programming_Model.html
+    - https://wiki.osdev.org/RSDP
+    - https://wiki.osdev.org/MADT
+
+    only the tables needed to find the interrupt controllers are parsed:
+    RSDP -> RSDT (or XSDT) -> MADT ("APIC")
+*/
+
+/* where the BIOS may put the RSDP */
+#define ACPI_EBDA_PTR    0x40E      // real mode segment of the EBDA
+#define ACPI_BIOS_START  0x000E0000
+#define ACPI_BIOS_END    0x00100000
+
+/* MADT entry types */
+#define MADT_LAPIC           0
+#define MADT_IOAPIC          1
+#define MADT_ISO             2      // interrupt source override
+#define MADT_LAPIC_OVERRIDE  5      // 64-bit local APIC address
+
+#define MADT_PCAT_COMPAT 0x1        // flags: the 8259 PICs are present
+#define MADT_LAPIC_ENABLED 0x1      // local APIC entry flags: usable CPU
+
+/* interrupt source override flags (MPS INTI flags) */
+#define MADT_POLARITY_MASK 0x3
+#define MADT_POLARITY_LOW  0x3
+#define MADT_TRIGGER_MASK  0xC
+#define MADT_TRIGGER_LEVEL 0xC
+
+#define ACPI_MAX_CPUS    16
+#define ACPI_MAX_IOAPICS 4
+#define ISA_IRQS         16
+
+typedef struct _acpi_rsdp
+{
+	char signature[8];         // "RSD PTR "
+	uint8_t checksum;          // of the first 20 bytes
+	char oem_id[6];
+	uint8_t revision;          // 0 for ACPI 1.0, 2 from ACPI 2.0 on
+	uint32_t rsdt_address;
+	// ACPI 2.0
+	uint32_t length;
+	uint64_t xsdt_address;
+	uint8_t ext_checksum;      // of the whole structure
+	uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+/* header of every system description table */
+typedef struct _acpi_sdt
+{
+	char signature[4];
+	uint32_t length;           // header included
+	uint8_t revision;
+	uint8_t checksum;          // of the whole table
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_t;
+
+typedef struct _acpi_madt
+{
+	acpi_sdt_t header;
+	uint32_t lapic_address;
+	uint32_t flags;
+	// followed by variable length entries
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct _madt_entry
+{
+	uint8_t type;
+	uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+/* the interrupt controllers described by the MADT */
+typedef struct _madt_info
+{
+	physaddr_t lapic_address;
+	uint32_t flags;
+	uint32_t ncpus;
+	uint8_t lapic_ids[ACPI_MAX_CPUS];
+	uint32_t nioapics;
+	struct
+	{
+		uint8_t id;
+		physaddr_t address;
+		uint32_t gsi_base;    // first global system interrupt it serves
+	} ioapics[ACPI_MAX_IOAPICS];
+	// global system interrupt and INTI flags of each ISA IRQ,
+	// identity mapped, active high and edge triggered by default
+	uint32_t isa_gsi[ISA_IRQS];
+	uint16_t isa_flags[ISA_IRQS];
+	// bit n set if the GSI of ISA IRQ n was taken by the override of
+	// another IRQ (IRQ2 when IRQ0 goes to GSI 2): n isn't wired anywhere
+	uint16_t isa_claimed;
+} madt_info_t;
+
+/* finds the MADT and fills madt, returns -1 if there's no usable one */
+int acpi_madt_parse(madt_info_t* madt);
+
+#endif // !ACPI_H
@@ -0,0 +1,98 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <learnix/timer.h>
+#include <stdint.h>
+
+/*
+    SOURCES:
+    - Intel SDM Vol. 3A, chapter 11 (APIC)
+    - https://wiki.osdev.org/APIC
+    - https://wiki.osdev.org/IOAPIC
+    - 82093AA I/O APIC datasheet
+
+    the local APIC serves the pending interrupt with the highest
+    priority class first, which is vector >> 4: routing an IRQ to
+    a higher vector raises its priority
+*/
+
+#define IA32_APIC_BASE       0x1B
+#define APIC_BASE_ENABLE     0x800      // global enable of the local APIC
+#define APIC_BASE_ADDR_MASK  0xFFFFF000
+
+/* local APIC registers, offsets from its MMIO base */
+#define LAPIC_ID      0x020
+#define LAPIC_VER     0x030
+#define LAPIC_TPR     0x080     // task priority
+#define LAPIC_EOI     0x0B0
+#define LAPIC_SVR     0x0F0     // spurious interrupt vector
+#define LAPIC_ESR     0x280     // error status
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_ICR 0x380   // initial count
+#define LAPIC_TIMER_CCR 0x390   // current count
+#define LAPIC_TIMER_DCR 0x3E0   // divide configuration
+
+#define LAPIC_SVR_ENABLE 0x100  // software enable
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_LVT_NMI    0x400  // NMI delivery mode
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV16 0x3
+
+#define LAPIC_TIMER_IDX 0xF0    // highest priority class
+
+#define LAPIC_SPURIOUS_IDX 0xFF // low nibble must be all ones on P6
+
+/* I/O APIC registers, accessed through IOREGSEL and IOWIN */
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WIN    0x10
+#define IOAPIC_VER    0x01
+#define IOAPIC_REDTBL 0x10      // 2 registers for each entry
+
+/* redirection entry bits */
+#define IOAPIC_ACTIVE_LOW 0x2000
+#define IOAPIC_LEVEL      0x8000
+#define IOAPIC_MASKED     0x10000
+
+/* the timer is calibrated for 1 / LAPIC_CALIBRATE_HZ seconds */
+#define LAPIC_CALIBRATE_HZ 100
+
+/* local APIC registers, NULL while the 8259 PICs are in use */
+extern volatile uint32_t* lapic;
+
+/* the LAPIC timer as a clock event device */
+extern clock_event_t lapic_clock_event;
+
+/* called by kernel_main once the virtual memory is set up: switches
+   the ISA IRQs to the I/O APIC when the MADT describes one, returns
+   -1 and leaves the 8259 PICs in charge otherwise */
+int apic_init();
+
+/* measures the LAPIC timer frequency against the PIT,
+   returns -1 if it is unusable */
+int lapic_timer_calibrate();
+
+/* routes the ISA IRQ irq to vector, the entry keeps its mask,
+   returns -1 if no I/O APIC serves it */
+int ioapic_route_irq(uint8_t irq, uint8_t vector);
+
+/* returns the vector the ISA IRQ irq is routed to,
+   -1 if no I/O APIC serves it */
+int ioapic_irq_vector(uint8_t irq);
+
+/* disables the delivery of the ISA IRQ irq */
+void ioapic_mask_irq(uint8_t irq);
+
+/* enables the delivery of the ISA IRQ irq */
+void ioapic_unmask_irq(uint8_t irq);
+
+/* sends the End-Of-Interrupt command, a single MMIO write */
+static inline void
+lapic_eoi()
+{
+	lapic[LAPIC_EOI / 4] = 0;
+}
+
+#endif // !APIC_H
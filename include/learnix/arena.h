@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* NOTE: an arena hands out memory for a batch of short lived
+* objects by bumping a pointer, the objects can't be freed one
+* by one: arena_release() gives back the whole batch at once
+*
+* INTERFACE:
+* void arena_init(arena_t* arena)
+* void* arena_alloc(arena_t* arena, uint32_t size, uint32_t align)
+* void arena_release(arena_t* arena)
+*/
+
+// blocks are taken from the buddy allocator,
+// the smallest one has 2^ARENA_MIN_ORDER pages
+#define ARENA_MIN_ORDER 2               // 16 KB
+
+// block of physically contiguous pages,
+// this header sits at its start
+typedef struct __arena_block_t
+{
+	struct __arena_block_t* next;
+	uint32_t order;
+	uint32_t used;          // bytes in use, header included
+} arena_block_t;
+
+// an arena, usually living on the stack of the code
+// that owns the batch: the current block is the first
+typedef struct __arena_t
+{
+	arena_block_t* blocks;
+	uint32_t nblocks;
+	uint32_t bytes;         // bytes handed out
+} arena_t;
+
+// initializes an empty arena,
+// no memory is taken yet
+void
+arena_init(arena_t* arena);
+
+// returns size bytes aligned to align (a power of 2,
+// 0 for pointer alignment), NULL when out of memory
+void*
+arena_alloc(arena_t* arena, uint32_t size, uint32_t align);
+
+// frees every object of the arena, which
+// can then be used again
+void
+arena_release(arena_t* arena);
+
+void
+test_arena();
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* NOTE: cpu_features_init() runs cpuid once at boot and keeps the
+* features the kernel cares about in cpu_features, so that testing one
+* is a load and an and. It also picks the fastest memcpy() and memset()
+* of libc for the CPU, the other subsystems pick their fast paths at
+* their own initialization with cpu_has(): vm.c the TLB flush, ktime.c
+* the clocksource, timer.c the clock event device (through apic.c).
+*
+* INTERFACE:
+* void cpu_features_init()
+* int cpu_has(uint32_t feature)
+* void dbg_print_cpu_features()
+*/
+
+#define CPU_FEATURE_PSE           0x00000001    // 4 MB pages
+#define CPU_FEATURE_PGE           0x00000002    // global pages
+#define CPU_FEATURE_APIC          0x00000004    // local APIC
+#define CPU_FEATURE_TSC           0x00000008    // rdtsc
+#define CPU_FEATURE_INVARIANT_TSC 0x00000010    // TSC rate independent of P/C-states
+#define CPU_FEATURE_FXSR          0x00000020    // fxsave and fxrstor
+#define CPU_FEATURE_SSE           0x00000040
+#define CPU_FEATURE_SSE2          0x00000080
+#define CPU_FEATURE_ERMS          0x00000100    // fast rep movsb and rep stosb
+#define CPU_FEATURE_INVPCID       0x00000200    // invpcid
+
+// CPU_FEATURE_* of the running CPU
+extern uint32_t cpu_features;
+
+static inline int
+cpu_has(uint32_t feature)
+{
+	return (cpu_features & feature) != 0;
+}
+
+// probes the CPU, called first thing by kernel_main
+void
+cpu_features_init();
+
+// logs the vendor and the features over UART
+void
+dbg_print_cpu_features();
@@ -12,6 +12,11 @@
 #define CAPS_LOCK_PRESSED 0x3A
 #define CAPS_LOCK_RELEASED 0xBA // useless
 
+// scancodes waiting for the tasklet, a power of 2
+#define KEYBOARD_QUEUE_SIZE 64
+
+// top half, called by the IRQ1 handler: queues the
+// scancode, the tasklet decodes it later
 void keyboard_main();
 
 #endif
\ No newline at end of file
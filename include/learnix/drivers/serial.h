@@ -15,6 +15,10 @@
 #define COM1_MODEM_STATUS_REGISTER (COM1 + 6)
 #define COM1_SCRATCH_REGISTER (COM1 + 7)
 
+#define COM1_IRQ 4
+#define COM1_IER_RX 0x01                            // interrupt when a byte is received
+#define COM1_LSR_DATA_READY 0x01
+
 // initializes the serial port COM1
 int serial_init();
 
@@ -27,4 +31,8 @@ void serial_write(const char* str);
 // writes a formatted string on the serial stream
 void serial_printf(const char *format, ...);
 
+// calls fn from the COM1 interrupt handler for each byte received,
+// must be called after apic_init()
+void serial_set_rx_handler(void (*fn)(char c));
+
 #endif
@@ -5,7 +5,7 @@
 
 static const uint32_t VGA_WIDTH = 80;
 static const uint32_t VGA_HEIGHT = 25;
-static uint16_t* const VGA_MEMORY = (uint16_t*)0xC03FF000;	// @note paging mapping of the VGA buffer's physical location
+static uint16_t* const VGA_MEMORY = (uint16_t*)0xC00B8000;	// @note paging mapping of the VGA buffer's physical location
 
 enum vga_color {
 	VGA_COLOR_BLACK = 0,
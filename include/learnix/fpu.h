@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* NOTE: the kernel is compiled with -mgeneral-regs-only, so interrupts
+* and exceptions never touch the x87/SSE registers and don't save them.
+* Code using them (the files in KERN_SIMD_CFILES, see the Makefile)
+* must run between kernel_fpu_begin() and kernel_fpu_end().
+*
+* The state is saved lazily: CR0.TS is set outside the sections, and
+* inside a nested section until it uses the registers, so the first
+* FPU/SSE instruction of a section raises #NM. The #NM handler saves
+* the registers of the enclosing section, if they're loaded, and gives
+* the section a clean state, or its own if a nested section saved it.
+* Sections that don't use the registers cost a few instructions, and
+* a CR0 write when nested in one that does.
+*
+* Unmasked SSE exceptions raise #XM, which panics. They're all masked
+* by default.
+*
+* INTERFACE:
+* void fpu_init()
+* void kernel_fpu_begin()
+* void kernel_fpu_end()
+*/
+
+// nesting levels of sections, e.g. a section in a softirq
+// that interrupted one in the idle loop
+#define FPU_MAX_DEPTH 4
+
+// MXCSR at reset: every exception masked, round to nearest
+#define MXCSR_DEFAULT 0x1F80
+
+// FXSAVE area
+typedef struct __fpu_state_t
+{
+	uint8_t regs[512];
+} __attribute__((aligned(16))) fpu_state_t;
+
+// set by fpu_init() if the CPU has FXSR and SSE2,
+// the sections can't be used otherwise
+extern int fpu_ready;
+
+// enables the FPU and SSE, called after idt_init()
+void
+fpu_init();
+
+// starts a section that may use the FPU and SSE registers,
+// it can be nested FPU_MAX_DEPTH times
+void
+kernel_fpu_begin();
+
+// ends the section, its registers are lost
+void
+kernel_fpu_end();
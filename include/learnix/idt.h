@@ -26,21 +26,57 @@ typedef struct _idt_entry {
    uint16_t offset_high;       // offset bits 16..31
 } __attribute__((packed)) idte_t;
 
-typedef struct _interrupt_frame
+/* Exceptions handled by the kernel */
+#define DIVIDE_ERROR_IDX 0
+#define BREAKPOINT_IDX 3
+#define DEVICE_NOT_AVAILABLE_IDX 7
+#define PAGE_FAULT_IDX 14
+#define SIMD_EXCEPTION_IDX 19
+
+/* number of 8259 IRQ lines, mapped from IRQ0_IDX on */
+#define IRQ_LINES 16
+
+/* bytes taken by each entry stub in isr.S */
+#define ISR_STUB_SIZE 16
+
+/* Trap frame, built on the stack by the isr.S stubs */
+typedef struct _trapframe
 {
-	uint32_t ip;   // instruction at which the exception happened
+	// pushed by isr_common (pushal)
+	uint32_t edi;
+	uint32_t esi;
+	uint32_t ebp;
+	uint32_t esp;        // before pushal, not the interrupted esp
+	uint32_t ebx;
+	uint32_t edx;
+	uint32_t ecx;
+	uint32_t eax;
+	// pushed by the stub
+	uint32_t vector;
+	uint32_t error_code; // 0 when the CPU doesn't push one
+	// pushed by the CPU
+	uint32_t ip;         // instruction at which the exception happened
 	uint32_t cs;
 	uint32_t flags;
-	uint32_t sp;
-	uint32_t ss;
-} interrupt_frame_t;
+} trapframe_t;
+
+/* handler of an IDT vector, ctx is the pointer given at registration */
+typedef void (*irq_handler_t)(trapframe_t* tf, void* ctx);
 
 void idt_init();
 
-static inline void idt_load();
+/* installs fn as the handler of vector, replacing the previous one,
+   returns -1 if vector is out of range. IRQs are acknowledged by
+   isr_dispatch() after fn returns */
+int register_irq_handler(uint32_t vector, irq_handler_t fn, void* ctx);
+
+/* enables ISA IRQ line irq on the I/O APIC, or on the 8259 PICs
+   when there's no APIC */
+void irq_unmask(uint8_t irq);
 
-static inline void idt_set_gate(int n, uint32_t handler, uint16_t selector, uint8_t type_attributes);
+/* called by the isr.S stubs with interrupts disabled */
+void isr_dispatch(trapframe_t* tf);
 
-void irq1_handler();
+void irq1_handler(trapframe_t* tf, void* ctx);
 
 #endif // ! INTERRUPTS_H
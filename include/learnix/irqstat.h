@@ -0,0 +1,85 @@
+#pragma once
+
+#include <learnix/idt.h>
+#include <stdint.h>
+
+/*
+* NOTE: per vector interrupt statistics: how many times the handler ran,
+* the rdtsc cycles it took, in total and as a histogram of log2 buckets
+* (bucket n counts the runs of 2^n to 2^(n+1) - 1 cycles), and the same
+* counters for the deferred work charged to the vector. The timer adds
+* the latency of its interrupt, from the deadline of the device to
+* timer_interrupt(), in nanoseconds.
+*
+* isr_dispatch() tests irqstat_enabled once per interrupt, so the
+* statistics cost a branch when off and two rdtsc and a few increments
+* when on. They're on from irqstat_init(), if there's a TSC.
+*
+* Typing 'i' on COM1 dumps the statistics over UART, 'z' clears them.
+*
+* INTERFACE:
+* void irqstat_init()
+* void irqstat_hard(uint32_t vector, uint64_t cycles)
+* void irqstat_soft(uint32_t vector, uint64_t cycles)
+* void irqstat_latency(uint32_t ns)
+* void irqstat_clear()
+* void dbg_print_irqstat()
+*/
+
+#define IRQSTAT_BUCKETS 32
+
+typedef struct __irqstat_t
+{
+	uint32_t runs;
+	uint32_t soft_runs;
+	uint64_t cycles;
+	uint64_t soft_cycles;
+	uint32_t hist[IRQSTAT_BUCKETS];
+	uint32_t soft_hist[IRQSTAT_BUCKETS];
+} irqstat_t;
+
+extern irqstat_t irqstat[IDT_ENTRIES];
+
+// 1 when the statistics are recorded, needs a TSC
+extern uint32_t irqstat_enabled;
+
+// log2 bucket of a duration
+static inline uint32_t
+irqstat_bucket(uint64_t value)
+{
+	if (value >> 32)
+		return IRQSTAT_BUCKETS - 1;
+	return 31 - __builtin_clz((uint32_t)value | 1);
+}
+
+// charges a run of the handler of vector, called by
+// isr_dispatch() with interrupts disabled
+static inline void
+irqstat_hard(uint32_t vector, uint64_t cycles)
+{
+	irqstat_t *stat = &irqstat[vector];
+
+	stat->runs++;
+	stat->cycles += cycles;
+	stat->hist[irqstat_bucket(cycles)]++;
+}
+
+// enables the statistics and the COM1 dump command
+void
+irqstat_init();
+
+// charges cycles of deferred work to vector
+void
+irqstat_soft(uint32_t vector, uint64_t cycles);
+
+// records the latency of a timer interrupt
+void
+irqstat_latency(uint32_t ns);
+
+// zeroes every counter
+void
+irqstat_clear();
+
+// dumps the statistics over UART
+void
+dbg_print_irqstat();
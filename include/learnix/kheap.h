@@ -1,36 +1,113 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 /*
 * NOTE: the kernel heap works with virtual addresses
 *
 * INTERFACE:
-* void kheap_init()
-* void kheap_grow()
+* void kheap_init(uintptr_t base)
+* int kheap_grow(uint32_t size)
 * void* kmalloc(uint32_t size)
+* void* kmalloc_aligned(uint32_t size, uint32_t align)
+* void* kcalloc(uint32_t n, uint32_t size)
+* void* krealloc(void* ptr, uint32_t size)
 * void kfree(void* ptr)
+* int kheap_check()
 */
 
-// chunk metadata
+// chunk flags, stored in the low bits of
+// the size since chunks are 8 byte aligned
+#define KHEAP_USED 0x1
+#define KHEAP_FLAGS 0x7
+
+// chunk sizes and payloads are multiples of KHEAP_ALIGN
+#define KHEAP_ALIGN 8
+
+// free chunks are kept in segregated lists: list i holds the
+// chunks with size in [2^(i+4), 2^(i+5)), the last one the rest
+#define KHEAP_NCLASSES 20
+
+// the heap break moves up by multiples of KHEAP_GROW_CHUNK,
+// and moves back down (giving back the frames above it) when
+// the free chunk at the top gets bigger than KHEAP_TRIM_THRESHOLD
+#define KHEAP_GROW_CHUNK 0x4000         // 16 KB
+#define KHEAP_TRIM_THRESHOLD 0x40000    // 256 KB
+
+// allocation profiler tables, both powers of 2: callsites
+// and allocations that are live while profiling
+#define KHEAP_PROF_SITES 64
+#define KHEAP_PROF_LIVE 1024
+
+// chunk metadata: the header is just the tagged size and is mirrored
+// by a footer in the last 4 bytes of the chunk (boundary tag), so that
+// kfree() can reach both neighbours. next and prev link free chunks
+// of the same size class and overlap the payload of used ones
 typedef struct __kheap_chunk_t
 {
-	uint32_t flags;
 	uint32_t size;
 	struct __kheap_chunk_t* next;
+	struct __kheap_chunk_t* prev;
 } kheap_chunk_t;
 
+// bytes in front of the payload: just the size, unless
+// pointers are 64 bit wide (hosted build) and pad it
+#define KHEAP_HEADER offsetof(kheap_chunk_t, next)
+
+// bytes of a chunk taken by its boundary tags
+#define KHEAP_TAGS (KHEAP_HEADER + sizeof(uint32_t))
+
+// a free chunk must fit its header, the list links and its footer
+#define KHEAP_MIN_CHUNK \
+	((sizeof(kheap_chunk_t) + sizeof(uint32_t) + KHEAP_ALIGN - 1) \
+	 & ~(KHEAP_ALIGN - 1))
+
+// allocation stats of a kmalloc() callsite
+typedef struct __kheap_site_t
+{
+	void* caller;           // return address of the allocation
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t live_bytes;
+	uint32_t peak_bytes;
+	uint32_t total_bytes;
+} kheap_site_t;
+
+// allocation tracked by the profiler, to charge
+// its callsite back when it is freed
+typedef struct __kheap_live_t
+{
+	void* ptr;
+	kheap_site_t* site;
+	uint32_t size;
+} kheap_live_t;
+
+// free memory of the heap, in bytes
+typedef struct __kheap_frag_t
+{
+	uint32_t heap_bytes;    // below the heap break
+	uint32_t free_bytes;
+	uint32_t free_chunks;
+	uint32_t largest_free;
+} kheap_frag_t;
+
 // called by the virtual memory system to
 // initialize the kernel heap
-// kernel_end: linker symbol that points to
-// the next free byte after kernel code
+// base: start of the heap window (KHEAP_BASE),
+// its pages are mapped on demand as it grows
 void 
-kheap_init(uintptr_t kernel_end);
+kheap_init(uintptr_t base);
 
-// called by kmalloc to request more
-// physical memory from the vm system
-void
-kheap_grow();
+// last address below the heap break: pages
+// up to it are mapped by the page fault handler
+extern uintptr_t kheap_end;
+
+// called by kmalloc to move the heap break up
+// so that a free chunk of size bytes exists at
+// the top, -1 if the heap window is full
+int
+kheap_grow(uint32_t size);
 
 void*
 kmalloc(uint32_t size);
@@ -38,7 +115,46 @@ kmalloc(uint32_t size);
 void
 kfree(void* ptr);
 
+// returns size bytes aligned to align (a power of 2),
+// the gap in front of them is given back to the heap
+void*
+kmalloc_aligned(uint32_t size, uint32_t align);
+
+// returns n * size zeroed bytes, NULL on overflow
+void*
+kcalloc(uint32_t n, uint32_t size);
+
+// resizes the allocation at ptr, in place when the
+// following chunk is free or ptr is at the top of the
+// heap, otherwise the data is moved to a new chunk
+void*
+krealloc(void* ptr, uint32_t size);
+
 // prints all the kheap
 // chunks
 void
 dbg_print_kheap();
+
+// walks every chunk and free list checking the boundary tags,
+// the coalescing and the class bitmap, returns -1 and logs
+// the first broken invariant, 0 if the heap is consistent
+int
+kheap_check();
+
+// clears the profiler tables and starts recording every
+// allocation with its callsite, live and peak bytes
+void
+kheap_profile_start();
+
+void
+kheap_profile_stop();
+
+// walks the free lists to measure free memory
+// and the largest free chunk
+void
+kheap_fragmentation(kheap_frag_t* frag);
+
+// prints the profiler callsites and
+// the fragmentation of the heap
+void
+dbg_print_kheap_profile();
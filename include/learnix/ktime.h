@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* NOTE: the TSC is the clocksource: ktime_init() measures its rate
+* against PIT channel 2 and from then on time is a read_tsc() away.
+* Cycles are converted to nanoseconds with a multiply and a shift,
+* ns = cycles * tsc_mult >> tsc_shift, no division involved. Without
+* a TSC the clocksource is the timer ticks, and the delays are
+* io_wait() loops.
+*
+* INTERFACE:
+* void ktime_init()
+* uint64_t ktime_ns()
+* uint64_t cyc2ns(uint64_t cycles)
+* void udelay(uint32_t us)
+* void ndelay(uint32_t ns)
+*/
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_USEC 1000
+
+// each calibration run lasts 1 / TSC_CALIBRATE_HZ seconds,
+// the shortest run has the least interference
+#define TSC_CALIBRATE_HZ 100
+#define TSC_CALIBRATE_RUNS 3
+
+// TSC rate, 0 if there's no TSC
+extern uint32_t tsc_khz;
+
+// cycles to nanoseconds factors
+extern uint32_t tsc_mult;
+extern uint32_t tsc_shift;
+
+// returns a * mul >> shift without overflowing
+// 64 bits, for shift <= 32
+static inline uint64_t
+mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift)
+{
+	uint64_t hi = (a >> 32) * mul;
+	uint64_t lo = (a & 0xFFFFFFFF) * mul;
+
+	return (hi << (32 - shift)) + (lo >> shift);
+}
+
+// converts TSC cycles to nanoseconds
+static inline uint64_t
+cyc2ns(uint64_t cycles)
+{
+	return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+// calibrates the TSC, only needs the PIT: called
+// first thing by kernel_main so that udelay() works
+void
+ktime_init();
+
+// returns the nanoseconds since ktime_init()
+uint64_t
+ktime_ns();
+
+// busy waits for at least us microseconds
+void
+udelay(uint32_t us);
+
+// busy waits for at least ns nanoseconds
+void
+ndelay(uint32_t ns);
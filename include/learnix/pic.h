@@ -30,22 +30,32 @@
 #define PIC1_OFFSET 0x20                // master PIC offset for protected mode
 #define PIC2_OFFSET (PIC1_OFFSET + 8)   // slave PIC offset for protected mode
 
+/* delay between the initialization words */
+#define PIC_DELAY_US 1
+
 /* 8259 PIC commands */
 #define PIC_EOI 0x20
+#define PIC_READ_ISR 0x0B   // OCW3: next read of the command port gives the ISR
+
+/* line of the master PIC the slave PIC is wired to */
+#define PIC_CASCADE_IRQ 2
 
 /* called by kernel_main during setup to initialize the PICs */
 void pic_init();
 
-/* remaps the PIC offsets to enable its use in protected mode */
-static void pic_remap(int master_offset, int slave_offset);
-
-/* enables the specified IRQ line */
-static void pic_set_mask(uint8_t irq_line);
+/* masks every IRQ line, called once the APIC takes over */
+void pic_disable();
 
 /* disables the specified IRQ line */
-static void pic_clear_mask(uint8_t irq_line);
+void pic_set_mask(uint8_t irq_line);
+
+/* enables the specified IRQ line */
+void pic_clear_mask(uint8_t irq_line);
 
 /* sends the End-Of-Interrupt command */
 void pic_send_eoi(uint8_t irq);
 
+/* returns the in-service registers, slave PIC in the high byte */
+uint16_t pic_get_isr();
+
 #endif // !PIC_H:
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include <learnix/timer.h>
+#include <stdint.h>
+
+/*
+    SOURCES:
+    - https://wiki.osdev.org/Programmable_Interval_Timer
+    - https://pdos.csail.mit.edu/6.828/2005/readings/hardware/8253.pdf
+*/
+
+/* 8253/8254 PIT magic values */
+#define PIT_FREQ     1193182    // input clock in Hz
+#define PIT_CH0      0x40       // wired to IRQ0
+#define PIT_CH2      0x42       // wired to the PC speaker
+#define PIT_COMMAND  0x43
+#define PIT_CH2_GATE 0x61       // NMI status and control port
+
+/* command byte */
+#define PIT_SEL_CH0   0x00
+#define PIT_SEL_CH2   0x80
+#define PIT_READBACK  0xC0      // read-back command, see pit_elapsed()
+#define PIT_LOHI      0x30      // access low then high byte
+#define PIT_MODE0     0x00      // interrupt on terminal count (one-shot)
+#define PIT_MODE2     0x04      // rate generator (periodic)
+
+/* read-back command and status byte */
+#define PIT_RB_NOCOUNT 0x20     // don't latch the count
+#define PIT_RB_NOSTATUS 0x10    // don't latch the status
+#define PIT_RB_CH0     0x02
+#define PIT_STATUS_OUT 0x80     // state of the output pin
+
+/* port 0x61 bits */
+#define PIT_GATE2    0x01       // channel 2 counts while set
+#define PIT_SPEAKER  0x02
+#define PIT_OUT2     0x20       // output of channel 2
+
+/* channel 0 as a clock event device */
+extern clock_event_t pit_clock_event;
+
+/* busy waits until channel 2 counted count PIT cycles,
+   with the speaker off: the reference for calibrations */
+void pit_ch2_wait(uint16_t count);
+
+#endif // !PIT_H
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* NOTE: routines using the SSE2 registers, kernel/simd.c is the only
+* file compiled without -mgeneral-regs-only. They must be called
+* between kernel_fpu_begin() and kernel_fpu_end(), once fpu_ready
+* is set.
+*
+* INTERFACE:
+* void simd_clear_page(void* page)
+*/
+
+// zeroes a page with non-temporal stores, which bypass the
+// caches: for pages that won't be used soon
+void
+simd_clear_page(void* page);
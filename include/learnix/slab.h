@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* NOTE: object caches hand out fixed size objects carved
+* from single frames of the page allocator, reached
+* through the physmap
+*
+* INTERFACE:
+* kmem_cache_t* kmem_cache_create(name, size, align, ctor)
+* void* kmem_cache_alloc(kmem_cache_t* cache)
+* void kmem_cache_free(kmem_cache_t* cache, void* obj)
+* int kmem_cache_destroy(kmem_cache_t* cache)
+*/
+
+// alignment that keeps every object
+// in its own cache lines
+#define KMEM_CACHE_LINE 64
+
+// largest object a cache can hold
+#define KMEM_MAX_OBJ_SIZE 1024
+
+// kmem_cache_create() rejects the size and alignment
+// pairs that leave room for fewer objects in a slab
+#define KMEM_MIN_OBJS_PER_SLAB 3
+
+// slab metadata, stored at the start of its frame
+// so that kmem_cache_free() finds it by rounding
+// down the object address
+typedef struct __kmem_slab_t
+{
+	struct __kmem_slab_t* next;
+	struct __kmem_slab_t* prev;
+	struct __kmem_cache_t* cache;
+	void* free;             // first free object (embedded freelist)
+	uint32_t inuse;         // allocated objects
+} kmem_slab_t;
+
+// cache of objects of the same size
+typedef struct __kmem_cache_t
+{
+	const char* name;
+	uint32_t size;          // requested object size
+	uint32_t slot;          // bytes between two objects
+	uint32_t offset;        // offset of the freelist link in a free object
+	uint32_t first;         // offset of the first object in a slab
+	uint32_t objs_per_slab;
+	void (*ctor)(void*);
+	kmem_slab_t* partial;   // slabs with some free objects
+	kmem_slab_t* empty;     // a slab kept around when everything is freed
+	uint32_t nslabs;
+	uint32_t nactive;       // allocated objects across all slabs
+} kmem_cache_t;
+
+// returns a new cache of objects of size bytes aligned to align
+// (a power of 2, 0 for pointer alignment), ctor is called once
+// for each object when its slab is created and freed objects
+// must be given back in their constructed state
+kmem_cache_t*
+kmem_cache_create(const char* name, uint32_t size, uint32_t align,
+                  void (*ctor)(void*));
+
+// returns a free object of the cache, NULL if
+// there's no physical memory left
+void*
+kmem_cache_alloc(kmem_cache_t* cache);
+
+// gives obj back to the cache it came from
+void
+kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+// frees the cache and its slabs, -1 (and nothing
+// is freed) if some of its objects are still in use
+int
+kmem_cache_destroy(kmem_cache_t* cache);
+
+// called by vm_setup() once the page allocator is ready
+void
+kmem_cache_init();
+
+void
+dbg_print_kmem_cache(kmem_cache_t* cache);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <learnix/idt.h>
+#include <stdint.h>
+
+/*
+* NOTE: interrupt handlers (top halves) only acknowledge the device and
+* queue a small record, then raise a softirq. Softirqs run at the end
+* of isr_dispatch(), after the EOI and with interrupts enabled, unless
+* the interrupted code had them disabled: in that case they wait for
+* the next interrupt or for the idle loop. They never nest.
+*
+* Tasklets are the softirq drivers use: a tasklet runs once however
+* many times it was scheduled before running.
+*
+* INTERFACE:
+* void open_softirq(uint32_t nr, void (*fn)())
+* void raise_softirq(uint32_t nr)
+* void do_softirq()
+* void tasklet_schedule(tasklet_t* tasklet)
+*/
+
+enum
+{
+	TIMER_SOFTIRQ,
+	TASKLET_SOFTIRQ,
+	NR_SOFTIRQS
+};
+
+// rounds of do_softirq() before it leaves the
+// work raised meanwhile to the idle loop
+#define SOFTIRQ_MAX_RESTART 4
+
+// deferred function, to be scheduled from an interrupt handler:
+// irqstat charges the cycles it takes to vector
+typedef struct __tasklet_t
+{
+	struct __tasklet_t* next;
+	uint32_t scheduled;
+	uint32_t vector;
+	void (*fn)(void* ctx);
+	void* ctx;
+} tasklet_t;
+
+#define TASKLET_INIT(fn, ctx, vector) { NULL, 0, (vector), (fn), (ctx) }
+
+// softirqs raised and not run yet, one bit each
+extern volatile uint32_t softirq_pending;
+
+// sets the function of softirq nr
+void
+open_softirq(uint32_t nr, void (*fn)());
+
+// marks softirq nr pending, safe from interrupt handlers
+void
+raise_softirq(uint32_t nr);
+
+// runs the pending softirqs with interrupts enabled,
+// must be called with interrupts disabled
+void
+do_softirq();
+
+// queues tasklet to run once, unless it is queued already
+void
+tasklet_schedule(tasklet_t* tasklet);
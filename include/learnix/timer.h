@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* NOTE: time is counted in ticks of 1 / TIMER_HZ seconds. Timers live
+* in a hierarchical timer wheel: the first level has one slot per tick
+* for the next 256 ticks, each of the other levels has 64 slots that
+* are 64 times coarser than the ones of the level below. Adding or
+* deleting a timer is O(1), a slot is moved (cascaded) one level down
+* when the level below wraps around. The timer interrupt only counts
+* the ticks, expired timers run from TIMER_SOFTIRQ with interrupts
+* enabled.
+*
+* In one-shot (tickless) mode the clock event device is programmed for
+* the next deadline instead of firing every tick, so an idle CPU sleeps
+* in hlt until a timer is due.
+*
+* INTERFACE:
+* void timer_init()
+* uint64_t timer_ticks()
+* void timer_setup(ktimer_t* timer, void (*fn)(void* ctx), void* ctx)
+* void timer_add(ktimer_t* timer, uint32_t expires)
+* int timer_del(ktimer_t* timer)
+*/
+
+#define TIMER_HZ 1000
+
+// 1 to program each deadline, 0 to tick at TIMER_HZ
+#define TIMER_ONESHOT 1
+
+// timer wheel geometry: 8 + 4 * 6 = 32 bits of ticks
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVN_LEVELS 4
+
+#define ms_to_ticks(ms) ((ms) * TIMER_HZ / 1000)
+
+// compares ticks across the wraparound of 32 bits
+#define time_before(a, b) ((int32_t)((a) - (b)) < 0)
+
+// a device that raises an interrupt after a number
+// of cycles of its counter, once or periodically
+typedef struct __clock_event_t
+{
+	const char* name;
+	uint32_t freq;                         // counter frequency in Hz
+	uint32_t max_delta;                    // longest count it takes
+	void (*set_periodic)(uint32_t count);
+	void (*set_oneshot)(uint32_t count);
+	// cycles since the last set_*(), past the count of a one-shot
+	// when the device can tell, the count itself otherwise
+	uint32_t (*elapsed)();
+} clock_event_t;
+
+// links of a timer in its wheel slot
+typedef struct __timer_link_t
+{
+	struct __timer_link_t* next;
+	struct __timer_link_t* prev;
+} timer_link_t;
+
+// a timer, owned by its user: it must stay
+// alive until it runs or timer_del() drops it
+typedef struct __ktimer_t
+{
+	timer_link_t link;      // must be the first member
+	uint32_t expires;       // tick it runs at
+	uint32_t slot;          // wheel slot, while pending
+	void (*fn)(void* ctx);
+	void* ctx;
+} ktimer_t;
+
+// starts the LAPIC timer or, without an APIC, the PIT,
+// nothing else in here works before it
+void
+timer_init();
+
+// returns the ticks since timer_init()
+uint64_t
+timer_ticks();
+
+// sets the function called when timer expires
+void
+timer_setup(ktimer_t* timer, void (*fn)(void* ctx), void* ctx);
+
+// schedules timer to run at tick expires (see timer_ticks()),
+// a pending timer is moved to the new deadline
+void
+timer_add(ktimer_t* timer, uint32_t expires);
+
+// cancels timer, returns 1 if it was pending
+int
+timer_del(ktimer_t* timer);
+
+void
+test_timer();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <learnix/multiboot.h>
 #include <learnix/x86/mmu.h>
 
 /*
@@ -47,51 +48,139 @@ typedef uint32_t physaddr_t;      // physical address
 #define EXT_MEM_BASE 0x00100000     // extended physical memory address (1MB)
 #define KERN_BASE_PHYS 0x00200000   // kernel physical link address (2MB)
 #define KERN_BASE_VRT 0xC0000000    // kernel base virtual address (3 GB)
+#define PHYS_MEM_LIMIT 0x100000000ULL // physical memory reachable without PAE (4 GB)
+
+// physmap: [0, PHYSMAP_LIMIT) is mapped at KERN_BASE_VRT so that
+// pa2kva() works for every low memory frame, frames above it
+// (high memory) must be mapped with kmap() to be accessed
+#define PHYSMAP_LIMIT 0x28000000    // 640 MB
+
+// kernel heap virtual window, right after the physmap:
+// its pages are faulted in as the heap break moves up
+#define KHEAP_BASE 0xE8000000
+#define KHEAP_END 0xF0000000
+
+// pages[] virtual window: 16 MB are enough to describe
+// every page frame of the 4 GB physical address space
+#define PAGES_VBASE 0xF0000000
+#define PAGES_VSIZE 0x01000000
+
+// virtual window for kernel mappings that aren't backed
+// by contiguous physical memory, see vmalloc.h
+#define VMALLOC_BASE 0xF1000000
+#define VMALLOC_END 0xFF800000
+
+// kmap() window: one page table of temporary mappings
+// for high memory frames, right below the recursive mapping
+#define KMAP_BASE 0xFF800000
+#define KMAP_SLOTS 1024
 
 // physical page metadata flags:
 #define PPM_KERN 0x000F             // is a kernel's code physical page
+#define PPM_FREE 0x0010             // is the head of a block in a buddy free list
+
+// buddy allocator:
+// blocks of 2^order contiguous physical pages are tracked
+// in per-order free lists, the biggest block is 4 MB
+#define BUDDY_MAX_ORDER 10
+
+// buddy allocator zones, each one has its own free lists:
+// PHYSMAP_LIMIT is 4 MB aligned so a block never spans two zones
+#define ZONE_LOW 0                  // frames inside the physmap
+#define ZONE_HIGH 1                 // frames that need kmap()
+#define NR_ZONES 2
+
+// pages[] is backed and initialized one chunk at a time, a chunk
+// describes a 4 MB max order block so buddies never cross chunks
+#define PAGES_CHUNK_PFNS (1 << BUDDY_MAX_ORDER)
+#define PAGES_CHUNK_SIZE (PAGES_CHUNK_PFNS * sizeof(physical_page_metadata_t))
+
+// deferred initialization of pages[]: only the chunks below
+// PAGES_EAGER_PFNS are initialized at boot (set it to the pfn
+// of PHYS_MEM_LIMIT to initialize everything eagerly), the rest
+// is done in batches of PAGES_DEFERRED_BATCH chunks by the idle
+// loop or as soon as less than PAGES_LOW_WATERMARK pages are free
+#define PAGES_EAGER_PFNS 4096          // 16 MB
+#define PAGES_DEFERRED_BATCH 1
+#define PAGES_LOW_WATERMARK 256
+
+// pool of pre-zeroed frames for page tables and demand-zero faults,
+// frames are cleared through the physmap from the idle loop
+#define ZERO_POOL_SIZE 32
+
+// unmapping more than this many pages reloads CR3
+// instead of issuing one invlpg per page
+#define TLB_FLUSH_THRESHOLD 32
 
 // RECURSIVE MAPPING MACROS
 
 // returns the virtual address of
 // the last entry of the page directory
-#define PGDIR_VADDR   ((pde_t*)0xFFFFF000);
+#define PGDIR_VADDR   ((pde_t*)(uintptr_t)0xFFFFF000)
 // returns the recursively mapped
 // virtual address to access the
 // given page table
-#define PT_VADDR(pdx) ((pte_t*)(0xFFC00000 + (pdx << 12)));
+#define PT_VADDR(pdx) ((pte_t*)(uintptr_t)(0xFFC00000 + ((pdx) << 12)))
 
 /// physical page metadata
-/// @param next pointer to the next free page
-/// @param ref_count number of virtual memory mappings to this physical page
+/// @param next pointer to the next free block of the same order
+/// @param prev pointer to the previous free block of the same order
+/// @param ref_count number of virtual memory mappings to this physical page,
+///        for page tables it is the number of present entries
+/// @param order order of the block this page is the head of
 typedef struct __physical_page_info {
     struct __physical_page_info* next;
+    struct __physical_page_info* prev;
     uint16_t ref_count;
-    uint16_t flags;
+    uint8_t flags;
+    uint8_t order;
 } physical_page_metadata_t;
 
+/// usable physical memory region, in page frame numbers
+/// @param start_pfn first usable page frame
+/// @param end_pfn first page frame after the region
+typedef struct __mem_region {
+    uint32_t start_pfn;
+    uint32_t end_pfn;
+} mem_region_t;
+
+#define MAX_MEM_REGIONS 32
+
+_Static_assert(PAGES_CHUNK_SIZE % PGSIZE == 0,
+               "a pages[] chunk must fill whole pages");
+
 extern physical_page_metadata_t* pages;
+extern mem_region_t mem_regions[MAX_MEM_REGIONS];
+extern uint32_t nmem_regions;
 
 /// returns the page number of the given physical address
 inline uint32_t page_num(physaddr_t pa) {
-    return (PGROUNDDOWN(pa) - EXT_MEM_BASE) >> 12;
+    return pa >> PTXSHIFT;
 }
 
 // returns the physical address of a given physical_page_metada struct
 inline physaddr_t page2pa(physical_page_metadata_t *pp) {
-	return EXT_MEM_BASE + ((pp - pages) * PGSIZE);
+	return (physaddr_t)(pp - pages) << PTXSHIFT;
 }
 
 inline physical_page_metadata_t* pa2pp(physaddr_t pa) {
 	return &pages[page_num(pa)];
 }
 
+/// returns the buddy allocator zone of the given physical page
+inline uint32_t page_zone(physical_page_metadata_t* pp) {
+    return page2pa(pp) < PHYSMAP_LIMIT ? ZONE_LOW : ZONE_HIGH;
+}
+
 /// returns the corresponding kernel virtual address (>3GB) of the physical address provided
 /// @param pa the physical address to translate
+/// @note only valid below PHYSMAP_LIMIT, use kmap() for high memory
 inline void* pa2kva(physaddr_t pa) {
-    return (void*)(pa + KERN_BASE_VRT);
+    return (void*)(uintptr_t)(pa + KERN_BASE_VRT);
 }
 
+/// returns the physmap address of pp, valid for every
+/// frame returned by page_alloc() and page_alloc_order()
 inline void* pp2kva(physical_page_metadata_t* pp) {
     return pa2kva(page2pa(pp));
 }
@@ -104,17 +193,70 @@ inline physaddr_t kva2pa(uintptr_t va) {
 extern pde_t* kern_pgdir;
 
 /// called once in kernel_main to initialize the virtual memory system
-void vm_setup(uint32_t memlower, uint32_t memupper);
+/// @param mbi multiboot info, its memory map describes the usable RAM
+void vm_setup(multiboot_info_t* mbi);
 
-/// called by vm_setup() to initialize the pages[] array
+/// boot time bump allocator, starting right after the kernel image,
+/// for data that must exist before the page allocator does
+/// @param align power of 2, 0 for pointer alignment
+/// @return kernel virtual address, only reachable through the boot page
+///         table (first 4 MB) until the physmap is set up
+/// @note panics once pages_setup() handed the rest of the region over
+void* boot_alloc(uint32_t size, uint32_t align);
+
+/// called by vm_setup() to build the pages[] array from mem_regions[]
 void pages_setup();
 
+/// initializes up to nchunks deferred chunks of pages[]
+/// returns the number of chunks advanced, holes included: 0 when
+/// done, or when called back while a chunk is being mapped
+uint32_t pages_deferred_init(uint32_t nchunks);
+
 /// returns the next free physical page
 physical_page_metadata_t* page_alloc();
 
 /// frees the provided physical page if ref_count is 0 and returns it, NULL on error
 physical_page_metadata_t* page_free(physical_page_metadata_t* pp);
 
+/// returns the first page of a block of 2^order physically contiguous
+/// pages, aligned to its own size, or NULL if no such block is free
+physical_page_metadata_t* page_alloc_order(uint32_t order);
+
+/// returns a free physical page, preferably from high memory:
+/// for pages that are only accessed through their own mappings
+/// @note the page may not be in the physmap, use kmap() to access it
+physical_page_metadata_t* page_alloc_high();
+
+/// frees a block of 2^order pages previously returned by page_alloc_order()
+/// merging it with its free buddies, returns pp or NULL on error
+physical_page_metadata_t* page_free_order(physical_page_metadata_t* pp, uint32_t order);
+
+/// returns the number of free physical pages
+uint32_t page_free_count();
+
+/// zero pool counters
+/// @param hits allocations served by an already cleared frame
+/// @param misses allocations that found the pool empty
+/// @param avail frames currently in the pool
+typedef struct __zero_pool_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t avail;
+} zero_pool_stats_t;
+
+/// clears frames until the pool is full, returns how many were added
+/// @note meant to be called when there's nothing else to do
+uint32_t zero_pool_refill();
+
+/// returns a pre-zeroed frame, NULL if the pool is empty
+physical_page_metadata_t* zero_pool_get();
+
+/// returns a zeroed frame, clearing it on the spot if the pool is empty
+physical_page_metadata_t* page_alloc_zeroed();
+
+/// copies the zero pool counters to stats
+void zero_pool_stats(zero_pool_stats_t* stats);
+
 /// returns a pointer to the pte (page table entry) of given virtual address (va)
 /// @param pgdir pointer to the page directory to use
 /// @param va virtual address
@@ -131,10 +273,59 @@ void map_va(pde_t* pgdir, uintptr_t va, physaddr_t pa);
 /// maps the given physical page to va
 void map_pp(pde_t* pgdir, physical_page_metadata_t* pp, uintptr_t va);
 
-// removes the mapping of va and frees (if possible) the physical page
-// of his page table
+/// maps the 4 MB page at pa to va with a single PS page directory entry,
+/// a page table previously installed at va's PDE is dropped without being freed
+/// @return 0 on success, -1 if PSE is unavailable or va/pa aren't 4 MB aligned
+int map_large(pde_t* pgdir, uintptr_t va, physaddr_t pa);
+
+// removes the mapping of va and frees the physical page of his
+// page table if it was the last present entry
 void unmap_va(pde_t* pgdir, uintptr_t va);
 
+/// maps npages consecutive pages from va to pa, walking each page table once
+/// @param flags PTE flags besides PTE_P (ex. PTE_W)
+/// @return 0, or -1 if a page table couldn't be made (the pages before it stay mapped)
+int map_range(pde_t* pgdir, uintptr_t va, physaddr_t pa, uint32_t npages, uint32_t flags);
+
+/// removes the mappings of npages consecutive pages starting from va,
+/// frees the page tables left empty and invalidates the TLB once at the end
+void unmap_range(pde_t* pgdir, uintptr_t va, uint32_t npages);
+
+/// page fault counters
+/// @param heap faults served inside the kernel heap
+/// @param vmalloc faults served inside a vmalloc() area
+/// @param bad faults that couldn't be served
+/// @param cycles total rdtsc cycles spent serving faults
+/// @param max_cycles slowest fault served
+typedef struct __vm_fault_stats {
+    uint32_t heap;
+    uint32_t vmalloc;
+    uint32_t bad;
+    uint64_t cycles;
+    uint32_t max_cycles;
+} vm_fault_stats_t;
+
+/// called by the page fault handler: maps a zeroed frame at va if it
+/// lies in a lazily backed kernel range (heap or vmalloc area)
+/// @param error_code error code pushed by the CPU
+/// @return 0 if the faulting access can be restarted, -1 otherwise
+int vm_page_fault(uintptr_t va, uint32_t error_code);
+
+/// copies the page fault counters to stats
+void vm_fault_stats(vm_fault_stats_t* stats);
+
+/// like unmap_range(), but also gives the frames that were mapped
+/// back to the page allocator
+void unmap_range_free(pde_t* pgdir, uintptr_t va, uint32_t npages);
+
+/// returns a kernel virtual address to access pp: its physmap address
+/// for low memory, a temporary mapping in the kmap window otherwise
+/// @note every kmap() must be paired with a kunmap()
+void* kmap(physical_page_metadata_t* pp);
+
+/// releases an address returned by kmap()
+void kunmap(void* va);
+
 void
 test_vm_system();
 
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <learnix/vm.h>
+#include <stdint.h>
+
+/*
+* NOTE: vmalloc() only reserves virtual addresses inside
+* [VMALLOC_BASE, VMALLOC_END), the page fault handler
+* backs each page with a zeroed frame on first access.
+* ioremap() areas share the window but are mapped right
+* away, uncached, to device memory
+*
+* INTERFACE:
+* void* vmalloc(uint32_t size)
+* void vfree(void* addr)
+* void* ioremap(physaddr_t pa, uint32_t size)
+* void iounmap(void* addr)
+*/
+
+// maximum number of live vmalloc() areas
+#define VMALLOC_MAX_AREAS 64
+
+// vm_area_t flags
+#define VM_IOREMAP 0x1 // mapped by ioremap()
+
+// virtual area handed out by vmalloc() or ioremap(),
+// followed by an unmapped guard page
+typedef struct __vm_area_t
+{
+	uintptr_t start;
+	uint32_t npages;
+	uint32_t flags;
+} vm_area_t;
+
+// reserves size bytes (rounded up to whole pages)
+// of virtual memory, NULL if the window is full
+void*
+vmalloc(uint32_t size);
+
+// frees the pages of an area returned by
+// vmalloc() that were touched and releases it
+void
+vfree(void* addr);
+
+// returns 1 if va belongs to a live vmalloc() area
+int
+vmalloc_contains(uintptr_t va);
+
+// maps size bytes of device memory starting at pa, returns
+// the address of pa or NULL if the window is full
+void*
+ioremap(physaddr_t pa, uint32_t size);
+
+// unmaps an address returned by ioremap()
+void
+iounmap(void* addr);
@@ -27,21 +27,66 @@
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define LGPGSIZE        0x400000 // bytes mapped by a large (PSE) page
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
+#define LGPGROUNDUP(sz)  (((sz)+LGPGSIZE-1) & ~(LGPGSIZE-1))
+#define LGPGOFFSET(va)   ((uintptr_t)(va) & (LGPGSIZE-1))
 
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_PWT         0x008   // Write-Through
+#define PTE_PCD         0x010   // Cache-Disable
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uintptr_t)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uintptr_t)(pte) &  0xFFF)
 
+// Address in a page directory entry with PTE_PS set
+#define LGPTE_ADDR(pde) ((uintptr_t)(pde) & ~(LGPGSIZE-1))
+
+// Page fault error codes
+#define FEC_PR          0x1     // Page fault caused by protection violation
+#define FEC_WR          0x2     // Page fault caused by a write
+#define FEC_U           0x4     // Page fault occured while in user mode
+
+// Eflags register
+#define FL_IF           0x00000200      // Interrupt Enable
+
+// Control Register flags
+#define CR0_MP          0x00000002      // Monitor coprocessor
+#define CR0_EM          0x00000004      // Emulation
+#define CR0_TS          0x00000008      // Task switched
+#define CR0_NE          0x00000020      // Numeric error
+#define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
+#define CR4_OSFXSR      0x00000200      // FXSAVE/FXRSTOR and SSE enabled
+#define CR4_OSXMMEXCPT  0x00000400      // Unmasked SSE exceptions raise #XM
+
+// CPUID.1:EDX feature flags
+#define CPUID_EDX_PSE   0x00000008      // Page size extension
+#define CPUID_EDX_TSC   0x00000010      // Time stamp counter
+#define CPUID_EDX_APIC  0x00000200      // On-chip local APIC
+#define CPUID_EDX_PGE   0x00002000      // Page global enable
+#define CPUID_EDX_FXSR  0x01000000      // FXSAVE and FXRSTOR
+#define CPUID_EDX_SSE   0x02000000      // SSE
+#define CPUID_EDX_SSE2  0x04000000      // SSE2
+
+// CPUID.(EAX=07H,ECX=0):EBX structured extended feature flags
+#define CPUID_EXT_FEATURES 0x00000007
+#define CPUID_EBX_ERMS  0x00000200      // Enhanced rep movsb/stosb
+#define CPUID_EBX_INVPCID 0x00000400    // INVPCID instruction
+
+// CPUID.80000007H:EDX advanced power management flags
+#define CPUID_EXT_PM    0x80000007
+#define CPUID_EDX_INVARIANT_TSC 0x00000100 // constant rate in every state
+
 #endif // !MMU_H
\ No newline at end of file
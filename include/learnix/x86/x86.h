@@ -1,6 +1,7 @@
 #ifndef X86_H
 #define X86_H
 
+#include <learnix/x86/mmu.h>
 #include <stdint.h>
 
 static inline void
@@ -199,6 +200,76 @@ tlbflush(void)
 	asm volatile("movl %0,%%cr3" : : "r" (cr3));
 }
 
+// also drops the global entries, which survive a CR3 reload:
+// clearing CR4.PGE flushes the whole TLB
+static inline void
+tlbflush_all(void)
+{
+	uint32_t cr4 = rcr4();
+	if (cr4 & CR4_PGE)
+	{
+		lcr4(cr4 & ~CR4_PGE);
+		lcr4(cr4);
+	}
+	else
+		tlbflush();
+}
+
+// INVPCID type 2: flushes every PCID, global entries
+// included, in one instruction instead of two CR4 writes
+static inline void
+invpcid_flush_all(void)
+{
+	uint64_t desc[2] = { 0, 0 };
+	asm volatile("invpcid (%0),%1" : : "r" (desc), "r" (2) : "memory");
+}
+
+static inline void
+clts(void)
+{
+	asm volatile("clts");
+}
+
+// the next FPU/SSE instruction raises #NM
+static inline void
+stts(void)
+{
+	lcr0(rcr0() | CR0_TS);
+}
+
+static inline void
+fninit(void)
+{
+	asm volatile("fninit");
+}
+
+// addr must be 16 bytes aligned, 512 bytes
+static inline void
+fxsave(void *addr)
+{
+	asm volatile("fxsave (%0)" : : "r" (addr) : "memory");
+}
+
+static inline void
+fxrstor(const void *addr)
+{
+	asm volatile("fxrstor (%0)" : : "r" (addr) : "memory");
+}
+
+static inline void
+ldmxcsr(uint32_t val)
+{
+	asm volatile("ldmxcsr %0" : : "m" (val));
+}
+
+static inline uint32_t
+stmxcsr(void)
+{
+	uint32_t val;
+	asm volatile("stmxcsr %0" : "=m" (val));
+	return val;
+}
+
 static inline uint32_t
 read_eflags(void)
 {
@@ -213,6 +284,18 @@ write_eflags(uint32_t eflags)
 	asm volatile("pushl %0; popfl" : : "r" (eflags));
 }
 
+static inline void
+cli(void)
+{
+	asm volatile("cli");
+}
+
+static inline void
+sti(void)
+{
+	asm volatile("sti");
+}
+
 static inline uint32_t
 read_ebp(void)
 {
@@ -229,6 +312,25 @@ read_esp(void)
 	return esp;
 }
 
+// cpuid for the leaves with subleaves, in ecx
+static inline void
+cpuid_count(uint32_t info, uint32_t subleaf, uint32_t *eaxp, uint32_t *ebxp,
+            uint32_t *ecxp, uint32_t *edxp)
+{
+	uint32_t eax, ebx, ecx, edx;
+	asm volatile("cpuid"
+		     : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		     : "a" (info), "c" (subleaf));
+	if (eaxp)
+		*eaxp = eax;
+	if (ebxp)
+		*ebxp = ebx;
+	if (ecxp)
+		*ecxp = ecx;
+	if (edxp)
+		*edxp = edx;
+}
+
 static inline void
 cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
 {
@@ -254,6 +356,20 @@ read_tsc(void)
 	return tsc;
 }
 
+static inline uint64_t
+rdmsr(uint32_t msr)
+{
+	uint64_t val;
+	asm volatile("rdmsr" : "=A" (val) : "c" (msr));
+	return val;
+}
+
+static inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
 static inline uint32_t
 xchg(volatile uint32_t *addr, uint32_t newval)
 {
@@ -0,0 +1,214 @@
+#include <learnix/acpi.h>
+#include <learnix/drivers/serial.h>
+#include <learnix/vm.h>
+#include <learnix/vmalloc.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static uint8_t
+acpi_checksum(const void *p, uint32_t len)
+{
+	const uint8_t *b = p;
+	uint8_t sum = 0;
+
+	while (len--)
+		sum += *b++;
+	return sum;
+}
+
+// returns a kernel virtual address for len bytes at pa:
+// tables in RAM are usually in the physmap already
+static void *
+acpi_map(physaddr_t pa, uint32_t len)
+{
+	uintptr_t va = (uintptr_t)pa2kva(pa);
+
+	if (pa + len <= PHYSMAP_LIMIT && va_to_pa(kern_pgdir, va) == pa
+	    && va_to_pa(kern_pgdir, va + len - 1) == pa + len - 1)
+		return (void *)va;
+	return ioremap(pa, len);
+}
+
+static void
+acpi_unmap(void *va)
+{
+	if ((uintptr_t)va >= VMALLOC_BASE)
+		iounmap(va);
+}
+
+// scans [start, end) on 16 bytes boundaries for a valid RSDP
+static acpi_rsdp_t *
+rsdp_scan(physaddr_t start, physaddr_t end)
+{
+	for (physaddr_t pa = start; pa + 20 <= end; pa += 16)
+	{
+		acpi_rsdp_t *rsdp = pa2kva(pa);
+		if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0
+		    && acpi_checksum(rsdp, 20) == 0)
+			return rsdp;
+	}
+	return NULL;
+}
+
+// the RSDP is either in the first KB of the EBDA
+// or in the BIOS area, both are in the physmap
+static acpi_rsdp_t *
+rsdp_find()
+{
+	physaddr_t ebda = *(uint16_t *)pa2kva(ACPI_EBDA_PTR) << 4;
+	acpi_rsdp_t *rsdp = NULL;
+
+	if (ebda >= 0x80000 && ebda < 0xA0000)
+		rsdp = rsdp_scan(ebda, ebda + 1024);
+	if (rsdp == NULL)
+		rsdp = rsdp_scan(ACPI_BIOS_START, ACPI_BIOS_END);
+	return rsdp;
+}
+
+// maps the whole table at pa if its checksum is valid, NULL otherwise
+static acpi_sdt_t *
+sdt_map(physaddr_t pa)
+{
+	acpi_sdt_t *sdt = acpi_map(pa, sizeof(acpi_sdt_t));
+	uint32_t len;
+
+	if (sdt == NULL)
+		return NULL;
+	len = sdt->length;
+	acpi_unmap(sdt);
+	if (len < sizeof(acpi_sdt_t))
+		return NULL;
+
+	if ((sdt = acpi_map(pa, len)) != NULL && acpi_checksum(sdt, len) != 0)
+	{
+		acpi_unmap(sdt);
+		return NULL;
+	}
+	return sdt;
+}
+
+// looks for the table with the given signature in the RSDT or,
+// on ACPI 2.0 systems, in the XSDT, the table is left mapped
+static acpi_sdt_t *
+acpi_find_table(acpi_rsdp_t *rsdp, const char *signature)
+{
+	// XSDT entries are 64 bits wide, RSDT ones 32
+	uint64_t root = rsdp->rsdt_address;
+	uint32_t entry_size = 4;
+
+	if (rsdp->revision >= 2 && rsdp->xsdt_address != 0
+	    && rsdp->xsdt_address < PHYS_MEM_LIMIT
+	    && acpi_checksum(rsdp, sizeof(*rsdp)) == 0)
+	{
+		root = rsdp->xsdt_address;
+		entry_size = 8;
+	}
+
+	acpi_sdt_t *rsdt = sdt_map(root);
+	if (rsdt == NULL)
+		return NULL;
+
+	acpi_sdt_t *found = NULL;
+	uint8_t *entries = (uint8_t *)(rsdt + 1);
+	uint32_t n = (rsdt->length - sizeof(*rsdt)) / entry_size;
+	for (uint32_t i = 0; i < n && found == NULL; i++)
+	{
+		uint64_t pa = entry_size == 8 ? *(uint64_t *)(entries + i * 8)
+		                              : *(uint32_t *)(entries + i * 4);
+		if (pa == 0 || pa >= PHYS_MEM_LIMIT)
+			continue;
+
+		acpi_sdt_t *sdt = sdt_map(pa);
+		if (sdt == NULL)
+			continue;
+		if (memcmp(sdt->signature, signature, 4) == 0)
+			found = sdt;
+		else
+			acpi_unmap(sdt);
+	}
+	acpi_unmap(rsdt);
+	return found;
+}
+
+int
+acpi_madt_parse(madt_info_t *madt)
+{
+	acpi_rsdp_t *rsdp = rsdp_find();
+
+	if (rsdp == NULL)
+	{
+		serial_printf("[LOG] ACPI: no RSDP\n");
+		return -1;
+	}
+
+	acpi_madt_t *table = (acpi_madt_t *)acpi_find_table(rsdp, "APIC");
+	if (table == NULL)
+	{
+		serial_printf("[LOG] ACPI: no MADT\n");
+		return -1;
+	}
+
+	memset(madt, 0, sizeof(*madt));
+	madt->lapic_address = table->lapic_address;
+	madt->flags = table->flags;
+	for (uint32_t irq = 0; irq < ISA_IRQS; irq++)
+		madt->isa_gsi[irq] = irq;
+
+	uint8_t *p = (uint8_t *)(table + 1);
+	uint8_t *end = (uint8_t *)table + table->header.length;
+	while (p + sizeof(madt_entry_t) <= end)
+	{
+		madt_entry_t *entry = (madt_entry_t *)p;
+		if (entry->length < sizeof(madt_entry_t) || p + entry->length > end)
+			break;
+
+		switch (entry->type)
+		{
+		case MADT_LAPIC:
+			// processor id, APIC id, flags
+			if ((*(uint32_t *)(p + 4) & MADT_LAPIC_ENABLED)
+			    && madt->ncpus < ACPI_MAX_CPUS)
+				madt->lapic_ids[madt->ncpus++] = p[3];
+			break;
+		case MADT_IOAPIC:
+			// id, reserved, address, gsi base
+			if (madt->nioapics < ACPI_MAX_IOAPICS)
+			{
+				uint32_t n = madt->nioapics++;
+				madt->ioapics[n].id = p[2];
+				madt->ioapics[n].address = *(uint32_t *)(p + 4);
+				madt->ioapics[n].gsi_base = *(uint32_t *)(p + 8);
+			}
+			break;
+		case MADT_ISO:
+			// bus (always ISA), source IRQ, gsi, flags
+			if (p[3] < ISA_IRQS)
+			{
+				madt->isa_gsi[p[3]] = *(uint32_t *)(p + 4);
+				madt->isa_flags[p[3]] = *(uint16_t *)(p + 8);
+			}
+			break;
+		case MADT_LAPIC_OVERRIDE:
+			// reserved, 64-bit address
+			if (*(uint64_t *)(p + 4) < PHYS_MEM_LIMIT)
+				madt->lapic_address = *(uint64_t *)(p + 4);
+			break;
+		}
+		p += entry->length;
+	}
+	acpi_unmap(table);
+
+	// an IRQ without an override loses its identity mapped
+	// GSI to the IRQ whose override points there
+	for (uint32_t irq = 0; irq < ISA_IRQS; irq++)
+	{
+		uint32_t gsi = madt->isa_gsi[irq];
+		if (gsi != irq && gsi < ISA_IRQS && madt->isa_gsi[gsi] == gsi)
+			madt->isa_claimed |= 1u << gsi;
+	}
+
+	serial_printf("[LOG] ACPI: %d CPUs, %d I/O APICs, local APIC at %x\n",
+	              madt->ncpus, madt->nioapics, madt->lapic_address);
+	return madt->nioapics > 0 ? 0 : -1;
+}
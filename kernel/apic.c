@@ -0,0 +1,285 @@
+#include <learnix/acpi.h>
+#include <learnix/apic.h>
+#include <learnix/cpu.h>
+#include <learnix/drivers/serial.h>
+#include <learnix/idt.h>
+#include <learnix/ktime.h>
+#include <learnix/pic.h>
+#include <learnix/pit.h>
+#include <learnix/vmalloc.h>
+#include <learnix/x86/mmu.h>
+#include <learnix/x86/x86.h>
+#include <stddef.h>
+#include <stdint.h>
+
+volatile uint32_t *lapic;
+
+static void lapic_timer_set_periodic(uint32_t count);
+static void lapic_timer_set_oneshot(uint32_t count);
+static uint32_t lapic_timer_elapsed();
+
+clock_event_t lapic_clock_event = {
+	.name = "lapic",
+	.max_delta = 0xFFFFFFFF,
+	.set_periodic = lapic_timer_set_periodic,
+	.set_oneshot = lapic_timer_set_oneshot,
+	.elapsed = lapic_timer_elapsed,
+};
+
+// count and TSC of the last lapic_timer_set_*() call
+static uint32_t lapic_timer_count;
+static uint64_t lapic_timer_tsc;
+
+static madt_info_t madt;
+
+// registers and number of redirection entries of each I/O APIC
+static volatile uint32_t *ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_nentries[ACPI_MAX_IOAPICS];
+
+// every IRQ is delivered to the boot CPU
+static uint8_t bsp_apic_id;
+
+static uint32_t
+ioapic_read(volatile uint32_t *ioapic, uint32_t reg)
+{
+	ioapic[IOAPIC_REGSEL / 4] = reg;
+	return ioapic[IOAPIC_WIN / 4];
+}
+
+static void
+ioapic_write(volatile uint32_t *ioapic, uint32_t reg, uint32_t val)
+{
+	ioapic[IOAPIC_REGSEL / 4] = reg;
+	ioapic[IOAPIC_WIN / 4] = val;
+}
+
+// returns the I/O APIC serving the ISA irq and its input pin,
+// -1 if no I/O APIC serves it or its pin belongs to another IRQ
+static int
+ioapic_lookup(uint8_t irq, uint32_t *pin)
+{
+	if (irq >= ISA_IRQS || (madt.isa_claimed & (1u << irq)))
+		return -1;
+
+	uint32_t gsi = madt.isa_gsi[irq];
+	for (uint32_t i = 0; i < madt.nioapics; i++)
+	{
+		if (ioapics[i] != NULL && gsi >= madt.ioapics[i].gsi_base
+		    && gsi - madt.ioapics[i].gsi_base < ioapic_nentries[i])
+		{
+			*pin = gsi - madt.ioapics[i].gsi_base;
+			return i;
+		}
+	}
+	return -1;
+}
+
+int
+ioapic_route_irq(uint8_t irq, uint8_t vector)
+{
+	uint32_t pin;
+	int i = ioapic_lookup(irq, &pin);
+
+	if (i < 0)
+		return -1;
+
+	// fixed delivery to a physical destination, ISA IRQs are
+	// active high and edge triggered unless the MADT overrides it
+	uint32_t reg = IOAPIC_REDTBL + 2 * pin;
+	uint32_t low = (ioapic_read(ioapics[i], reg) & IOAPIC_MASKED) | vector;
+	uint16_t flags = madt.isa_flags[irq];
+	if ((flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW)
+		low |= IOAPIC_ACTIVE_LOW;
+	if ((flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL)
+		low |= IOAPIC_LEVEL;
+
+	// keep the entry masked while it is half written
+	uint32_t eflags = read_eflags();
+	cli();
+	ioapic_write(ioapics[i], reg, low | IOAPIC_MASKED);
+	ioapic_write(ioapics[i], reg + 1, (uint32_t)bsp_apic_id << 24);
+	ioapic_write(ioapics[i], reg, low);
+	write_eflags(eflags);
+	return 0;
+}
+
+int
+ioapic_irq_vector(uint8_t irq)
+{
+	uint32_t pin;
+	int i = ioapic_lookup(irq, &pin);
+
+	if (i < 0)
+		return -1;
+	return ioapic_read(ioapics[i], IOAPIC_REDTBL + 2 * pin) & 0xFF;
+}
+
+static void
+ioapic_set_mask(uint8_t irq, int masked)
+{
+	uint32_t pin;
+	int i = ioapic_lookup(irq, &pin);
+
+	if (i < 0)
+		return;
+
+	uint32_t eflags = read_eflags();
+	cli();
+	uint32_t low = ioapic_read(ioapics[i], IOAPIC_REDTBL + 2 * pin);
+	low = masked ? low | IOAPIC_MASKED : low & ~IOAPIC_MASKED;
+	ioapic_write(ioapics[i], IOAPIC_REDTBL + 2 * pin, low);
+	write_eflags(eflags);
+}
+
+void
+ioapic_mask_irq(uint8_t irq)
+{
+	ioapic_set_mask(irq, 1);
+}
+
+void
+ioapic_unmask_irq(uint8_t irq)
+{
+	ioapic_set_mask(irq, 0);
+}
+
+// the local APIC drops a spurious interrupt without
+// setting it in service, so it gets no EOI
+static void
+spurious_interrupt(trapframe_t *tf, void *ctx)
+{
+	(void)tf;
+	(void)ctx;
+}
+
+static void
+lapic_setup(volatile uint32_t *regs)
+{
+	// global enable, at the address given by the MADT
+	uint64_t base = rdmsr(IA32_APIC_BASE) & ~(uint64_t)APIC_BASE_ADDR_MASK;
+	wrmsr(IA32_APIC_BASE, base | madt.lapic_address | APIC_BASE_ENABLE);
+
+	// accept every priority class
+	regs[LAPIC_TPR / 4] = 0;
+	// LINT0 carries the 8259 interrupts in virtual wire
+	// mode, the I/O APIC delivers them from now on
+	regs[LAPIC_LVT_LINT0 / 4] = LAPIC_LVT_MASKED;
+	regs[LAPIC_LVT_LINT1 / 4] = LAPIC_LVT_NMI;
+	regs[LAPIC_LVT_ERROR / 4] = LAPIC_LVT_MASKED;
+	// back to back writes clear the error status
+	regs[LAPIC_ESR / 4] = 0;
+	regs[LAPIC_ESR / 4] = 0;
+	// software enable
+	regs[LAPIC_SVR / 4] = LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_IDX;
+
+	bsp_apic_id = regs[LAPIC_ID / 4] >> 24;
+}
+
+static void
+lapic_timer_set_periodic(uint32_t count)
+{
+	lapic_timer_count = count;
+	lapic[LAPIC_LVT_TIMER / 4] = LAPIC_TIMER_PERIODIC | LAPIC_TIMER_IDX;
+	lapic[LAPIC_TIMER_ICR / 4] = count;
+}
+
+static void
+lapic_timer_set_oneshot(uint32_t count)
+{
+	lapic_timer_count = count;
+	lapic_timer_tsc = read_tsc();
+	lapic[LAPIC_LVT_TIMER / 4] = LAPIC_TIMER_IDX;
+	lapic[LAPIC_TIMER_ICR / 4] = count;
+}
+
+static uint32_t
+lapic_timer_elapsed()
+{
+	uint32_t left = lapic[LAPIC_TIMER_CCR / 4];
+
+	// a one-shot count stops at 0: the TSC tells
+	// how long ago, once it is calibrated
+	if (left == 0 && tsc_khz != 0)
+	{
+		uint64_t cycles = (read_tsc() - lapic_timer_tsc)
+		                  * (lapic_clock_event.freq / 1000) / tsc_khz;
+		if (cycles > lapic_timer_count && cycles <= 0xFFFFFFFF)
+			return cycles;
+	}
+	return lapic_timer_count - left;
+}
+
+int
+lapic_timer_calibrate()
+{
+	uint32_t eflags = read_eflags();
+	cli();
+	lapic[LAPIC_TIMER_DCR / 4] = LAPIC_TIMER_DIV16;
+	lapic[LAPIC_LVT_TIMER / 4] = LAPIC_LVT_MASKED | LAPIC_TIMER_IDX;
+	lapic[LAPIC_TIMER_ICR / 4] = 0xFFFFFFFF;
+	pit_ch2_wait(PIT_FREQ / LAPIC_CALIBRATE_HZ);
+	uint32_t counted = 0xFFFFFFFF - lapic[LAPIC_TIMER_CCR / 4];
+	lapic[LAPIC_TIMER_ICR / 4] = 0;
+	write_eflags(eflags);
+
+	// too slow to count a tick
+	if (counted < 2 * TIMER_HZ / LAPIC_CALIBRATE_HZ)
+	{
+		serial_printf("[LOG] LAPIC timer unusable\n");
+		return -1;
+	}
+	lapic_clock_event.freq = counted * LAPIC_CALIBRATE_HZ;
+	return 0;
+}
+
+int
+apic_init()
+{
+	volatile uint32_t *regs;
+
+	if (!cpu_has(CPU_FEATURE_APIC))
+	{
+		serial_printf("[LOG] no local APIC, using the 8259 PICs\n");
+		return -1;
+	}
+	if (acpi_madt_parse(&madt) < 0
+	    || (regs = ioremap(madt.lapic_address, PGSIZE)) == NULL)
+	{
+		serial_printf("[LOG] no MADT, using the 8259 PICs\n");
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < madt.nioapics; i++)
+	{
+		ioapics[i] = ioremap(madt.ioapics[i].address, PGSIZE);
+		// bits 16-23 of the version register: highest entry
+		if (ioapics[i] != NULL)
+			ioapic_nentries[i]
+			    = (ioapic_read(ioapics[i], IOAPIC_VER) >> 16 & 0xFF) + 1;
+	}
+
+	uint32_t eflags = read_eflags();
+	cli();
+	lapic_setup(regs);
+
+	// every ISA IRQ keeps the vector it had on the 8259s, the
+	// ones whose pin went to an override are skipped so that the
+	// pin isn't rewritten with their vector
+	for (uint8_t irq = 0; irq < ISA_IRQS; irq++)
+	{
+		if (ioapic_route_irq(irq, IRQ0_IDX + irq) == 0)
+			ioapic_mask_irq(irq);
+	}
+	register_irq_handler(LAPIC_SPURIOUS_IDX, spurious_interrupt, NULL);
+
+	// from here on isr_dispatch() acknowledges the local APIC
+	pic_disable();
+	lapic = regs;
+
+	// enable IRQ1 (keyboard line)
+	ioapic_unmask_irq(1);
+	write_eflags(eflags);
+
+	serial_printf("[LOG] APIC enabled, boot CPU APIC id %d\n", bsp_apic_id);
+	return 0;
+}
@@ -0,0 +1,136 @@
+#include <learnix/arena.h>
+#include <learnix/drivers/serial.h>
+#include <learnix/vm.h>
+#include <learnix/x86/mmu.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void
+arena_init(arena_t* arena)
+{
+	arena->blocks = NULL;
+	arena->nblocks = 0;
+	arena->bytes = 0;
+}
+
+// returns the address of the first byte at or after
+// the block's bump pointer aligned to align
+static inline uintptr_t
+block_next(arena_block_t* block, uint32_t align)
+{
+	uintptr_t va = (uintptr_t)block + block->used;
+	return (va + align - 1) & ~((uintptr_t)align - 1);
+}
+
+// returns 1 if an object of size bytes aligned
+// to align fits in what's left of the block
+static inline int
+block_fits(arena_block_t* block, uint32_t size, uint32_t align)
+{
+	uintptr_t next = block_next(block, align);
+	uintptr_t end = (uintptr_t)block + (PGSIZE << block->order);
+
+	// the rounding can wrap around for huge alignments
+	return next >= (uintptr_t)block && next <= end && size <= end - next;
+}
+
+void*
+arena_alloc(arena_t* arena, uint32_t size, uint32_t align)
+{
+	if (align == 0)
+		align = sizeof(void*);
+	if (align & (align - 1))
+		return NULL;
+
+	// the size of the block computed below must not wrap around
+	if (align > UINT32_MAX - sizeof(arena_block_t)
+	    || size > UINT32_MAX - sizeof(arena_block_t) - align)
+		return NULL;
+
+	// bump the pointer of the current block
+	arena_block_t* block = arena->blocks;
+	if (block == NULL || !block_fits(block, size, align))
+	{
+		// the smallest block that fits the header, the
+		// worst case padding and the object
+		uint32_t order = ARENA_MIN_ORDER;
+		uint32_t need = sizeof(arena_block_t) + align + size;
+		while (order <= BUDDY_MAX_ORDER && ((uint32_t)PGSIZE << order) < need)
+			order++;
+		if (order > BUDDY_MAX_ORDER)
+			return NULL;
+
+		// blocks come from the physmap, the
+		// old current block is not used anymore
+		physical_page_metadata_t* pp = page_alloc_order(order);
+		if (pp == NULL)
+			return NULL;
+		block = pp2kva(pp);
+		block->order = order;
+		block->used = sizeof(arena_block_t);
+
+		// the block was sized for the worst case padding,
+		// it's kept out of the arena if that falls short
+		if (!block_fits(block, size, align))
+		{
+			page_free_order(pp, order);
+			return NULL;
+		}
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->nblocks++;
+	}
+
+	uintptr_t va = block_next(block, align);
+	block->used = va + size - (uintptr_t)block;
+	arena->bytes += size;
+	return (void*)va;
+}
+
+void
+arena_release(arena_t* arena)
+{
+	arena_block_t* block = arena->blocks;
+
+	while (block != NULL)
+	{
+		arena_block_t* next = block->next;
+		page_free_order(pa2pp(kva2pa((uintptr_t)block)), block->order);
+		block = next;
+	}
+	arena_init(arena);
+}
+
+void
+test_arena()
+{
+	arena_t arena;
+	uint32_t free_before = page_free_count();
+
+	// 1) objects are aligned, consecutive
+	// and share the first block
+	arena_init(&arena);
+	uint8_t* a = arena_alloc(&arena, 10, 0);
+	uint8_t* b = arena_alloc(&arena, 100, 64);
+	if (a == NULL || b == NULL || ((uintptr_t)b & 63) || b < a + 10
+	    || arena.nblocks != 1)
+		panic("[ ARENA ] test 1 failed");
+
+	// 2) a request bigger than the block
+	// gets its own, bigger block
+	if (arena_alloc(&arena, 64 * 1024, 0) == NULL || arena.nblocks != 2)
+		panic("[ ARENA ] test 2 failed");
+
+	// 3) sizes that can't fit any block are rejected
+	if (arena_alloc(&arena, UINT32_MAX, 0) != NULL
+	    || arena_alloc(&arena, UINT32_MAX - 64, 4096) != NULL
+	    || arena.nblocks != 2)
+		panic("[ ARENA ] test 3 failed");
+
+	// 4) releasing gives every block back
+	arena_release(&arena);
+	if (page_free_count() != free_before || arena.blocks != NULL)
+		panic("[ ARENA ] test 4 failed");
+	serial_printf("[LOG] arena test passed\n");
+}
@@ -0,0 +1,88 @@
+#include <learnix/cpu.h>
+#include <learnix/drivers/serial.h>
+#include <learnix/x86/mmu.h>
+#include <learnix/x86/x86.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+uint32_t cpu_features;
+
+// vendor string of cpuid leaf 0
+static char cpu_vendor[13];
+
+static const char *feature_names[] = {
+	"pse", "pge", "apic", "tsc", "invariant_tsc",
+	"fxsr", "sse", "sse2", "erms", "invpcid",
+};
+
+// points memcpy() and memset() at the fastest
+// implementation for the CPU
+static void
+string_select()
+{
+	if (cpu_has(CPU_FEATURE_ERMS))
+	{
+		memcpy_impl = memcpy_erms;
+		memset_impl = memset_erms;
+	}
+}
+
+void
+cpu_features_init()
+{
+	uint32_t max, max_ext, ebx, ecx, edx;
+
+	cpuid(0, &max, &ebx, &ecx, &edx);
+	memcpy(cpu_vendor, &ebx, 4);
+	memcpy(cpu_vendor + 4, &edx, 4);
+	memcpy(cpu_vendor + 8, &ecx, 4);
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (edx & CPUID_EDX_PSE)
+		cpu_features |= CPU_FEATURE_PSE;
+	if (edx & CPUID_EDX_PGE)
+		cpu_features |= CPU_FEATURE_PGE;
+	if (edx & CPUID_EDX_APIC)
+		cpu_features |= CPU_FEATURE_APIC;
+	if (edx & CPUID_EDX_TSC)
+		cpu_features |= CPU_FEATURE_TSC;
+	if (edx & CPUID_EDX_FXSR)
+		cpu_features |= CPU_FEATURE_FXSR;
+	if (edx & CPUID_EDX_SSE)
+		cpu_features |= CPU_FEATURE_SSE;
+	if (edx & CPUID_EDX_SSE2)
+		cpu_features |= CPU_FEATURE_SSE2;
+
+	if (max >= CPUID_EXT_FEATURES)
+	{
+		cpuid_count(CPUID_EXT_FEATURES, 0, NULL, &ebx, NULL, NULL);
+		if (ebx & CPUID_EBX_ERMS)
+			cpu_features |= CPU_FEATURE_ERMS;
+		if (ebx & CPUID_EBX_INVPCID)
+			cpu_features |= CPU_FEATURE_INVPCID;
+	}
+
+	cpuid(0x80000000, &max_ext, NULL, NULL, NULL);
+	if (max_ext >= CPUID_EXT_PM)
+	{
+		cpuid(CPUID_EXT_PM, NULL, NULL, NULL, &edx);
+		if (edx & CPUID_EDX_INVARIANT_TSC)
+			cpu_features |= CPU_FEATURE_INVARIANT_TSC;
+	}
+
+	string_select();
+}
+
+void
+dbg_print_cpu_features()
+{
+	serial_printf("[LOG] CPU: %s,", cpu_vendor);
+	for (uint32_t n = 0; n < sizeof(feature_names) / sizeof(*feature_names);
+	     n++)
+	{
+		if (cpu_features & (1u << n))
+			serial_printf(" %s", feature_names[n]);
+	}
+	serial_printf("\n");
+}
@@ -1,5 +1,7 @@
 #include <ctype.h>
 #include <learnix/drivers/keyboard.h>
+#include <learnix/idt.h>
+#include <learnix/softirq.h>
 #include <learnix/x86/x86.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -8,6 +10,20 @@
 // bit 1: caps lock pressed
 static uint8_t status = 0;
 
+// scancodes read by keyboard_main() and not decoded yet: written
+// only by the interrupt handler, read only by the tasklet
+static uint8_t scancodes[KEYBOARD_QUEUE_SIZE];
+static volatile uint32_t scancodes_head;
+static volatile uint32_t scancodes_tail;
+
+// scancodes lost because the queue was full
+static uint32_t scancodes_dropped;
+
+static void keyboard_tasklet_fn(void *ctx);
+
+static tasklet_t keyboard_tasklet
+    = TASKLET_INIT(keyboard_tasklet_fn, NULL, IRQ1_IDX);
+
 char scancode_lowercase[] = {
 	0,    27,   '1', '2',  '3', '4',  '5',  '6',
 	'7',  '8',  '9', '0',  '-', '=',  '\b', // 0x00-0x0E
@@ -32,12 +48,10 @@ char scancode_uppercase[] = {
 	'*',  0,    ' ', 0        // 0x37-0x39
 };
 
-void
-keyboard_main()
+// decodes a scancode and prints its character
+static void
+keyboard_process(uint8_t scancode)
 {
-	// read scancode from keyboard data port
-	uint8_t scancode = inb(KEYBOARD_DATA_PORT);
-
 	// if the top bit is set means that a key was released
 	if (scancode & KEY_RELEASED_MASK)
 	{
@@ -79,4 +93,34 @@ keyboard_main()
 		}
 		}
 	}
+}
+
+// bottom half: decodes the queued scancodes
+// with interrupts enabled
+static void
+keyboard_tasklet_fn(void *ctx)
+{
+	(void)ctx;
+	while (scancodes_tail != scancodes_head)
+	{
+		keyboard_process(scancodes[scancodes_tail % KEYBOARD_QUEUE_SIZE]);
+		scancodes_tail++;
+	}
+}
+
+void
+keyboard_main()
+{
+	// read scancode from keyboard data port, this
+	// lets the controller raise the next IRQ
+	uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+
+	if (scancodes_head - scancodes_tail == KEYBOARD_QUEUE_SIZE)
+	{
+		scancodes_dropped++;
+		return;
+	}
+	scancodes[scancodes_head % KEYBOARD_QUEUE_SIZE] = scancode;
+	scancodes_head++;
+	tasklet_schedule(&keyboard_tasklet);
 }
\ No newline at end of file
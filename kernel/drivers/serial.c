@@ -1,6 +1,8 @@
 #include <learnix/drivers/serial.h>
+#include <learnix/idt.h>
 #include <learnix/x86/x86.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -43,6 +45,32 @@ serial_init()
 	return 0;
 }
 
+static void (*serial_rx_handler)(char c);
+
+static void
+serial_interrupt(trapframe_t *tf, void *ctx)
+{
+	(void)tf;
+	(void)ctx;
+
+	// the FIFO may hold more than one byte
+	while (inb(COM1_LINE_STATUS_REGISTER) & COM1_LSR_DATA_READY)
+	{
+		char c = inb(COM1);
+		if (serial_rx_handler != NULL)
+			serial_rx_handler(c);
+	}
+}
+
+void
+serial_set_rx_handler(void (*fn)(char c))
+{
+	serial_rx_handler = fn;
+	register_irq_handler(IRQ0_IDX + COM1_IRQ, serial_interrupt, NULL);
+	outb(COM1_INTERRUPT_ENABLE_REGISTER, COM1_IER_RX);
+	irq_unmask(COM1_IRQ);
+}
+
 void
 serial_writechar(char c)
 {
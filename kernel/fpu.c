@@ -0,0 +1,133 @@
+#include <learnix/cpu.h>
+#include <learnix/drivers/serial.h>
+#include <learnix/fpu.h>
+#include <learnix/idt.h>
+#include <learnix/x86/mmu.h>
+#include <learnix/x86/x86.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int fpu_ready;
+
+// sections in progress, and the one whose state
+// is in the registers (0 for none)
+static uint32_t fpu_depth;
+static uint32_t fpu_live;
+
+// bit n set if the state of section n was saved by a nested one
+static uint32_t fpu_saved;
+
+// saved states, by section, and the clean state
+// the sections start with
+static fpu_state_t fpu_states[FPU_MAX_DEPTH + 1];
+static fpu_state_t fpu_clean_state;
+
+// ISR 7: first FPU/SSE instruction since CR0.TS was set
+static void
+fpu_nm_exception(trapframe_t *tf, void *ctx)
+{
+	(void)ctx;
+	if (fpu_depth == 0)
+	{
+		printf("[Exception] FPU/SSE used outside kernel_fpu_begin() at %x\n",
+		       tf->ip);
+		panic("device not available");
+	}
+
+	clts();
+
+	// the registers belong to an enclosing section
+	if (fpu_live != 0)
+	{
+		fxsave(&fpu_states[fpu_live]);
+		fpu_saved |= 1u << fpu_live;
+	}
+
+	if (fpu_saved & (1u << fpu_depth))
+	{
+		fxrstor(&fpu_states[fpu_depth]);
+		fpu_saved &= ~(1u << fpu_depth);
+	}
+	else
+		fxrstor(&fpu_clean_state);
+	fpu_live = fpu_depth;
+}
+
+// ISR 19: unmasked SSE exception
+static void
+simd_exception(trapframe_t *tf, void *ctx)
+{
+	(void)ctx;
+	// the flags are bits 0-5 of MXCSR: invalid operation, denormal,
+	// divide by zero, overflow, underflow, precision
+	printf("[Exception] SIMD floating-point at %x, MXCSR %x\n", tf->ip,
+	       stmxcsr());
+	panic("SIMD floating-point exception");
+}
+
+void
+fpu_init()
+{
+	if (!cpu_has(CPU_FEATURE_FXSR) || !cpu_has(CPU_FEATURE_SSE)
+	    || !cpu_has(CPU_FEATURE_SSE2))
+	{
+		serial_printf("[LOG] no SSE2, FPU sections disabled\n");
+		return;
+	}
+
+	register_irq_handler(DEVICE_NOT_AVAILABLE_IDX, fpu_nm_exception, NULL);
+	register_irq_handler(SIMD_EXCEPTION_IDX, simd_exception, NULL);
+
+	// no emulation, fwait honours CR0.TS, x87 errors raise #MF
+	lcr0((rcr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+	clts();
+	fninit();
+	ldmxcsr(MXCSR_DEFAULT);
+	fxsave(&fpu_clean_state);
+	stts();
+
+	fpu_ready = 1;
+}
+
+void
+kernel_fpu_begin()
+{
+	uint32_t eflags = read_eflags();
+	cli();
+	if (fpu_depth == FPU_MAX_DEPTH)
+		panic("kernel_fpu_begin: too many nested sections");
+
+	// the registers of the enclosing section stay
+	// loaded until this one uses them
+	if (fpu_live != 0)
+		stts();
+	fpu_depth++;
+	write_eflags(eflags);
+}
+
+void
+kernel_fpu_end()
+{
+	uint32_t eflags = read_eflags();
+	cli();
+	if (fpu_live == fpu_depth)
+	{
+		// the registers are dropped, the enclosing
+		// section gets its own back at its next use
+		fpu_live = 0;
+		stts();
+	}
+	else if (fpu_live != 0 && fpu_live == fpu_depth - 1)
+	{
+		// this section didn't use them, they're still
+		// the ones of the enclosing section
+		clts();
+	}
+	fpu_saved &= ~(1u << fpu_depth);
+	fpu_depth--;
+	write_eflags(eflags);
+}
@@ -1,41 +1,94 @@
+#include <learnix/apic.h>
 #include <learnix/drivers/keyboard.h>
+#include <learnix/drivers/serial.h>
 #include <learnix/idt.h>
+#include <learnix/irqstat.h>
 #include <learnix/pic.h>
+#include <learnix/softirq.h>
+#include <learnix/vm.h>
+#include <learnix/x86/mmu.h>
 #include <learnix/x86/x86.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 idtr_t idtr;
 idte_t idt[IDT_ENTRIES]; // IDT
 
+// entry stubs of isr.S, one every ISR_STUB_SIZE bytes
+extern char isr_stubs[];
+
+// handler of each vector and its context
+typedef struct _irq_entry
+{
+	irq_handler_t fn;
+	void *ctx;
+} irq_entry_t;
+
+static irq_entry_t irq_handlers[IDT_ENTRIES];
+
+static const char *exception_names[32] = {
+	"divide error",
+	"debug",
+	"NMI",
+	"breakpoint",
+	"overflow",
+	"bound range exceeded",
+	"invalid opcode",
+	"device not available",
+	"double fault",
+	"coprocessor segment overrun",
+	"invalid TSS",
+	"segment not present",
+	"stack-segment fault",
+	"general protection fault",
+	"page fault",
+	"reserved",
+	"x87 floating-point exception",
+	"alignment check",
+	"machine check",
+	"SIMD floating-point exception",
+	"virtualization exception",
+	"control protection exception",
+};
+
 // ISR0: division by zero
-__attribute__((interrupt)) void
-division_by_zero_exception(interrupt_frame_t *frame)
+static void
+division_by_zero_exception(trapframe_t *tf, void *ctx)
 {
-	printf("[Exception] division by zero at %x\n", frame->ip);
+	(void)ctx;
+	printf("[Exception] division by zero at %x\n", tf->ip);
 	// halt CPU
 	asm volatile("hlt");
 }
 
 // IRS3: breakpoint (INT3 instruction)
-// frame->ip points to the byte after the INT3 instruction
-__attribute__((interrupt)) void
-breakpoint_exception(interrupt_frame_t *frame)
+// tf->ip points to the byte after the INT3 instruction
+static void
+breakpoint_exception(trapframe_t *tf, void *ctx)
 {
-	printf("Breakpoint at %x", frame->ip);
+	(void)ctx;
+	printf("Breakpoint at %x", tf->ip);
 }
 
 // ISR 14: page fault
-__attribute__((interrupt)) void
-page_fault_exception(interrupt_frame_t *frame, uint32_t error_code)
+static void
+page_fault_exception(trapframe_t *tf, void *ctx)
 {
 	// cr2 is set as the virtual address which caused the fault
 	uintptr_t fault_va = rcr2();
+
+	(void)ctx;
+	// the heap and vmalloc areas are backed lazily, once
+	// the page is mapped the faulting access is restarted
+	if (vm_page_fault(fault_va, tf->error_code) == 0)
+		return;
+
 	printf("[PAGE FAULT] eip=%x tried accessing va=%x\n| with error: ",
-	       frame->ip, fault_va);
+	       tf->ip, fault_va);
 	// check P bit (0th of error_code)
-	if ((error_code & 0x1) == 0)
+	if ((tf->error_code & 0x1) == 0)
 	{
 		puts("non-present page\n");
 	}
@@ -46,13 +99,127 @@ page_fault_exception(interrupt_frame_t *frame, uint32_t error_code)
 	asm volatile("hlt");
 }
 
-extern void irq1_wrapper();
+// vectors nobody registered: exceptions can't be resumed,
+// stray interrupts are only reported
+static void
+unhandled_interrupt(trapframe_t *tf)
+{
+	if (tf->vector >= 32)
+	{
+		serial_printf("[LOG] unhandled interrupt %d\n", tf->vector);
+		return;
+	}
+
+	printf("[Exception] %s (%d) at %x, error code %x\n",
+	       exception_names[tf->vector] != NULL ? exception_names[tf->vector]
+	                                           : "reserved",
+	       tf->vector, tf->ip, tf->error_code);
+	printf("eax=%x ebx=%x ecx=%x edx=%x\n", tf->eax, tf->ebx, tf->ecx,
+	       tf->edx);
+	printf("esi=%x edi=%x ebp=%x eflags=%x\n", tf->esi, tf->edi, tf->ebp,
+	       tf->flags);
+	panic("unhandled exception");
+}
+
+// acknowledges an IRQ to the controller that delivered it,
+// software interrupts and spurious IRQs aren't acknowledged
+static inline void
+irq_eoi(uint32_t vector)
+{
+	uint32_t irq = vector - IRQ0_IDX;
+
+	if (lapic != NULL)
+	{
+		// the I/O APIC keeps the vectors of the 8259 lines, the
+		// local APIC delivers its timer: anything else is either
+		// an int instruction or the spurious vector, which are
+		// never in service
+		if (irq < IRQ_LINES || vector == LAPIC_TIMER_IDX)
+			lapic_eoi();
+	}
+	else if (irq < IRQ_LINES)
+	{
+		// the lowest priority line of each PIC also carries its
+		// spurious IRQs, which aren't in service: the master still
+		// gets its EOI for a spurious IRQ 15, which went through
+		// the cascade line
+		if ((irq == 7 || irq == 15) && !(pic_get_isr() & (1u << irq)))
+		{
+			if (irq == 15)
+				pic_send_eoi(PIC_CASCADE_IRQ);
+			return;
+		}
+		pic_send_eoi(irq);
+	}
+}
 
 void
-irq1_handler()
+irq_unmask(uint8_t irq)
 {
+	if (lapic != NULL)
+		ioapic_unmask_irq(irq);
+	else
+		pic_clear_mask(irq);
+}
+
+void
+irq1_handler(trapframe_t *tf, void *ctx)
+{
+	(void)tf;
+	(void)ctx;
 	keyboard_main();
-	pic_send_eoi(1);
+}
+
+int
+register_irq_handler(uint32_t vector, irq_handler_t fn, void *ctx)
+{
+	if (vector >= IDT_ENTRIES)
+		return -1;
+
+	// the stub may fire while the entry is half written
+	uint32_t eflags = read_eflags();
+	cli();
+	irq_handlers[vector].fn = fn;
+	irq_handlers[vector].ctx = ctx;
+	write_eflags(eflags);
+	return 0;
+}
+
+// runs the handler of the vector of tf
+static inline void
+irq_call(trapframe_t *tf)
+{
+	irq_entry_t *entry = &irq_handlers[tf->vector];
+
+	if (entry->fn != NULL)
+		entry->fn(tf, entry->ctx);
+	else
+		unhandled_interrupt(tf);
+}
+
+void
+isr_dispatch(trapframe_t *tf)
+{
+	// the only test the statistics cost when they're off
+	if (irqstat_enabled)
+	{
+		uint64_t tsc = read_tsc();
+		irq_call(tf);
+		irqstat_hard(tf->vector, read_tsc() - tsc);
+	}
+	else
+		irq_call(tf);
+
+	if (tf->vector < IRQ0_IDX)
+		return;
+
+	// every IRQ is acknowledged here, once its handler is done
+	irq_eoi(tf->vector);
+
+	// then the deferred work runs, unless the
+	// interrupted code had interrupts disabled
+	if (softirq_pending != 0 && (tf->flags & FL_IF))
+		do_softirq();
 }
 
 static inline void
@@ -66,7 +233,7 @@ idt_load()
 	asm volatile("lidt (%0)" : : "r"(&idtr));
 
 	// enable interrupts
-	asm volatile("sti");
+	sti();
 }
 
 static inline void
@@ -87,16 +254,16 @@ idt_init()
 	// zero-out the IDT entries
 	memset(&idt, 0, sizeof(idte_t) * IDT_ENTRIES);
 
-	// 0: division by zero
-	idt_set_gate(0, (uint32_t)division_by_zero_exception, 0x08, 0x8E);
-	// 3: breakpoint (INT3 instruction)
-	idt_set_gate(3, (uint32_t)breakpoint_exception, 0x08, 0x8E);
-	// 14: page fault
-	idt_set_gate(14, (uint32_t)page_fault_exception, 0x08, 0x8E);
+	// every vector goes through its isr.S stub
+	for (uint32_t n = 0; n < IDT_ENTRIES; n++)
+		idt_set_gate(n, (uint32_t)isr_stubs + n * ISR_STUB_SIZE, 0x08, 0x8E);
+
+	register_irq_handler(DIVIDE_ERROR_IDX, division_by_zero_exception, NULL);
+	register_irq_handler(BREAKPOINT_IDX, breakpoint_exception, NULL);
+	register_irq_handler(PAGE_FAULT_IDX, page_fault_exception, NULL);
 
-	// setup interrupt service routines
-	idt_set_gate(IRQ1_IDX, (uint32_t)irq1_wrapper, 0x08,
-	             0x8E); // keyboard handler (IRQ1)
+	// keyboard handler (IRQ1)
+	register_irq_handler(IRQ1_IDX, irq1_handler, NULL);
 
 	// and finally load the IDT into the IDTR register
 	idt_load();
@@ -0,0 +1,132 @@
+#include <learnix/drivers/serial.h>
+#include <learnix/irqstat.h>
+#include <learnix/ktime.h>
+#include <learnix/softirq.h>
+#include <learnix/x86/x86.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+irqstat_t irqstat[IDT_ENTRIES];
+uint32_t irqstat_enabled;
+
+// timer interrupt latency, log2 buckets of nanoseconds
+static uint32_t latency_hist[IRQSTAT_BUCKETS];
+static uint32_t latency_max;
+
+// COM1 byte that asked for the tasklet
+static char irqstat_command;
+
+static void irqstat_tasklet_fn(void *ctx);
+
+static tasklet_t irqstat_tasklet
+    = TASKLET_INIT(irqstat_tasklet_fn, NULL, IRQ0_IDX + COM1_IRQ);
+
+// the dump is slow, it's left to the tasklet
+static void
+irqstat_rx(char c)
+{
+	if (c == 'i' || c == 'z')
+	{
+		irqstat_command = c;
+		tasklet_schedule(&irqstat_tasklet);
+	}
+}
+
+static void
+irqstat_tasklet_fn(void *ctx)
+{
+	(void)ctx;
+	if (irqstat_command == 'z')
+		irqstat_clear();
+	else
+		dbg_print_irqstat();
+}
+
+void
+irqstat_init()
+{
+	irqstat_enabled = tsc_khz != 0;
+	serial_set_rx_handler(irqstat_rx);
+}
+
+void
+irqstat_soft(uint32_t vector, uint64_t cycles)
+{
+	irqstat_t *stat = &irqstat[vector];
+
+	uint32_t eflags = read_eflags();
+	cli();
+	stat->soft_runs++;
+	stat->soft_cycles += cycles;
+	stat->soft_hist[irqstat_bucket(cycles)]++;
+	write_eflags(eflags);
+}
+
+void
+irqstat_latency(uint32_t ns)
+{
+	latency_hist[irqstat_bucket(ns)]++;
+	if (ns > latency_max)
+		latency_max = ns;
+}
+
+void
+irqstat_clear()
+{
+	uint32_t eflags = read_eflags();
+	cli();
+	memset(irqstat, 0, sizeof(irqstat));
+	memset(latency_hist, 0, sizeof(latency_hist));
+	latency_max = 0;
+	write_eflags(eflags);
+}
+
+// prints the non-empty buckets of hist on one line
+static void
+print_hist(const char *what, const uint32_t *hist)
+{
+	serial_printf("    %s:", what);
+	for (uint32_t n = 0; n < IRQSTAT_BUCKETS; n++)
+	{
+		if (hist[n] != 0)
+			serial_printf(" 2^%d:%d", n, hist[n]);
+	}
+	serial_printf("\n");
+}
+
+void
+dbg_print_irqstat()
+{
+	serial_printf("== IRQ STATS ==\n");
+	if (!irqstat_enabled)
+	{
+		serial_printf("disabled, no TSC\n");
+		return;
+	}
+
+	// one line per vector and one per histogram
+	for (uint32_t vector = 0; vector < IDT_ENTRIES; vector++)
+	{
+		// a copy, the counters keep moving
+		irqstat_t stat = irqstat[vector];
+		if (stat.runs == 0 && stat.soft_runs == 0)
+			continue;
+
+		serial_printf("vector %d: %d runs, %d cycles avg, "
+		              "deferred %d runs, %d cycles avg\n",
+		              vector, stat.runs,
+		              stat.runs ? (uint32_t)(stat.cycles / stat.runs) : 0,
+		              stat.soft_runs,
+		              stat.soft_runs
+		                  ? (uint32_t)(stat.soft_cycles / stat.soft_runs)
+		                  : 0);
+		if (stat.runs != 0)
+			print_hist("cycles", stat.hist);
+		if (stat.soft_runs != 0)
+			print_hist("deferred cycles", stat.soft_hist);
+	}
+
+	serial_printf("timer latency: %d ns max\n", latency_max);
+	print_hist("ns", latency_hist);
+}
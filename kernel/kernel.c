@@ -1,9 +1,17 @@
+#include <learnix/apic.h>
+#include <learnix/cpu.h>
 #include <learnix/drivers/serial.h>
 #include <learnix/drivers/vga.h>
+#include <learnix/fpu.h>
 #include <learnix/idt.h>
+#include <learnix/irqstat.h>
+#include <learnix/ktime.h>
 #include <learnix/multiboot.h>
 #include <learnix/pic.h>
+#include <learnix/softirq.h>
+#include <learnix/timer.h>
 #include <learnix/vm.h>
+#include <learnix/x86/x86.h>
 #include <stdio.h>
 
 void
@@ -22,19 +30,66 @@ kernel_main(uint32_t magic, multiboot_info_t *mbi)
 		panic("[GRUB] invalid memory map");
 	}
 
+	// probe the CPU and pick the fast paths it supports
+	cpu_features_init();
+
+	// calibrate the TSC against the PIT,
+	// udelay() is precise from here on
+	ktime_init();
+
 	// initialize the PIC
 	pic_init();
 
 	// initialize the COM1 serial port
 	serial_init();
+	dbg_print_cpu_features();
+	serial_printf("[LOG] TSC: %d kHz%s\n", tsc_khz,
+	              cpu_has(CPU_FEATURE_INVARIANT_TSC) ? ", invariant" : "");
 
 	// initialize the Interrupt Descriptor Table (IDT)
 	idt_init();
 
+	// enable the FPU and SSE for kernel_fpu_begin() sections
+	fpu_init();
+
 	// setup the virtual memory manager
-	vm_setup(mbi->mem_lower, mbi->mem_upper);
+	vm_setup(mbi);
+
+	// switch to the local and I/O APICs when the ACPI
+	// tables describe them, the PICs stay in use otherwise
+	apic_init();
 
+	// per vector interrupt statistics, 'i' on COM1 dumps them
+	irqstat_init();
+
+	// start the clock event device and the timer wheel
+	timer_init();
+
+	// run the softirqs the interrupts left behind, finish
+	// initializing pages[] and top up the zero pool while there's
+	// nothing else to do, then sleep until the next interrupt:
+	// with the one-shot timer, the next deadline
 	while (1)
 	{
+		cli();
+		if (softirq_pending != 0)
+		{
+			do_softirq();
+			sti();
+			continue;
+		}
+		sti();
+
+		if (pages_deferred_init(PAGES_DEFERRED_BATCH) == 0
+		    && zero_pool_refill() == 0)
+		{
+			// sti takes effect after hlt starts, an interrupt
+			// raising a softirq in between still wakes it up
+			cli();
+			if (softirq_pending == 0)
+				asm volatile("sti; hlt");
+			else
+				sti();
+		}
 	};
 }
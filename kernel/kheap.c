@@ -5,18 +5,194 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-// first virtual address of the
-// kernel heap
-kheap_chunk_t* chunks_free_list;
+// free lists of the size classes and the bitmap
+// of the non empty ones
+static kheap_chunk_t* kheap_classes[KHEAP_NCLASSES];
+static uint32_t kheap_classes_map;
 
-// currently last mapped virtual
-// address of kernel heap
+// first chunk of the heap, right after the
+// prologue footer
+static kheap_chunk_t* kheap_first;
+
+// last virtual address below the
+// heap break
 uintptr_t kheap_end;
 
+// allocation profiler, off unless
+// kheap_profile_start() is called
+static int kheap_profiling;
+static kheap_site_t kheap_sites[KHEAP_PROF_SITES];
+static kheap_live_t kheap_live[KHEAP_PROF_LIVE];
+static uint32_t kheap_prof_live_bytes, kheap_prof_peak_bytes;
+static uint32_t kheap_prof_untracked;
+
+// marks a kheap_live[] slot whose allocation was freed,
+// lookups go past it while inserts can reuse it
+#define KHEAP_PROF_TOMBSTONE ((void*)1)
+
+// returns the size class of a chunk of size bytes
+static inline uint32_t
+kheap_class(uint32_t size)
+{
+	// 31 - clz is the index of the highest set bit
+	uint32_t class = 31 - __builtin_clz(size) - 4;
+	return class < KHEAP_NCLASSES ? class : KHEAP_NCLASSES - 1;
+}
+
+static inline uint32_t
+chunk_size(kheap_chunk_t* chunk)
+{
+	return chunk->size & ~KHEAP_FLAGS;
+}
+
+// returns the footer of chunk
+static inline uint32_t*
+chunk_footer(kheap_chunk_t* chunk)
+{
+	return (uint32_t*)((uintptr_t)chunk + chunk_size(chunk)) - 1;
+}
+
+// writes both boundary tags of chunk
+static inline void
+chunk_set(kheap_chunk_t* chunk, uint32_t size, uint32_t flags)
+{
+	chunk->size = size | flags;
+	*chunk_footer(chunk) = size | flags;
+}
+
+// returns the chunk that physically follows chunk
+static inline kheap_chunk_t*
+chunk_next(kheap_chunk_t* chunk)
+{
+	return (kheap_chunk_t*)((uintptr_t)chunk + chunk_size(chunk));
+}
+
+// returns the footer of the chunk that physically precedes chunk
+static inline uint32_t
+chunk_prev_tag(kheap_chunk_t* chunk)
+{
+	return *((uint32_t*)chunk - 1);
+}
+
+// first byte after the chunk header
+static inline void*
+chunk_payload(kheap_chunk_t* chunk)
+{
+	return &chunk->next;
+}
+
+static inline kheap_chunk_t*
+payload_chunk(void* ptr)
+{
+	return (kheap_chunk_t*)((uintptr_t)ptr - KHEAP_HEADER);
+}
+
+// returns the epilogue header, right
+// below the heap break
+static inline kheap_chunk_t*
+kheap_epilogue()
+{
+	return (kheap_chunk_t*)(kheap_end + 1 - KHEAP_HEADER);
+}
+
+// pushes a free chunk on the list of its size class
+static void
+class_push(kheap_chunk_t* chunk)
+{
+	uint32_t class = kheap_class(chunk_size(chunk));
+
+	chunk->prev = NULL;
+	chunk->next = kheap_classes[class];
+	if (chunk->next != NULL)
+		chunk->next->prev = chunk;
+	kheap_classes[class] = chunk;
+	kheap_classes_map |= 1u << class;
+}
+
+// removes a free chunk from the list of its size class
+static void
+class_remove(kheap_chunk_t* chunk)
+{
+	uint32_t class = kheap_class(chunk_size(chunk));
+
+	if (chunk->prev != NULL)
+		chunk->prev->next = chunk->next;
+	else
+		kheap_classes[class] = chunk->next;
+	if (chunk->next != NULL)
+		chunk->next->prev = chunk->prev;
+	if (kheap_classes[class] == NULL)
+		kheap_classes_map &= ~(1u << class);
+}
+
+// merges the free chunk with its free physical neighbours,
+// which are found through the boundary tags in O(1), and
+// puts the result on its free list
+static kheap_chunk_t*
+chunk_coalesce(kheap_chunk_t* chunk)
+{
+	uint32_t size = chunk_size(chunk);
+
+	// the epilogue header is always used
+	kheap_chunk_t* next = chunk_next(chunk);
+	if (!(next->size & KHEAP_USED))
+	{
+		class_remove(next);
+		size += chunk_size(next);
+	}
+
+	// and so is the prologue footer
+	uint32_t prev_tag = chunk_prev_tag(chunk);
+	if (!(prev_tag & KHEAP_USED))
+	{
+		chunk = (kheap_chunk_t*)((uintptr_t)chunk - (prev_tag & ~KHEAP_FLAGS));
+		class_remove(chunk);
+		size += chunk_size(chunk);
+	}
+
+	chunk_set(chunk, size, 0);
+	class_push(chunk);
+	return chunk;
+}
+
+// returns a free chunk of at least size bytes, taken off
+// its free list, or NULL if none is free
+static kheap_chunk_t*
+chunk_find(uint32_t size)
+{
+	uint32_t class = kheap_class(size);
+
+	// chunks of the same class may be too small: first fit
+	for (kheap_chunk_t* c = kheap_classes[class]; c != NULL; c = c->next)
+	{
+		if (chunk_size(c) >= size)
+		{
+			class_remove(c);
+			return c;
+		}
+	}
+
+	// any chunk of a bigger class fits, pick the
+	// first non empty class from the bitmap
+	uint32_t bigger = class + 1 < KHEAP_NCLASSES
+	                      ? kheap_classes_map & ~((2u << class) - 1)
+	                      : 0;
+	if (bigger == 0)
+		return NULL;
+
+	kheap_chunk_t* c = kheap_classes[__builtin_ctz(bigger)];
+	class_remove(c);
+	return c;
+}
+
 static void
 kheap_test()
 {
+	// the tests double as a workload for the profiler
+	kheap_profile_start();
+
 	// 1) EZ: allocate 3 integers arrays of 50 items	
 	int* arr1 = (int*)kmalloc(50 * sizeof(int));
 	int* arr2 = (int*)kmalloc(100 * sizeof(int));
@@ -50,181 +226,683 @@ kheap_test()
 	printf("%x\n", str1);
 	dbg_print_kheap();
 
+	// 5) BATCH GROWTH AND TRIMMING
+	// a big request moves the break once,
+	// freeing it gives the pages back
+	serial_printf("\nTEST 5:\n");
+	uintptr_t end_before = kheap_end;
+	volatile char* big = (volatile char*)kmalloc(512 * 1024);
+	if (big == NULL || kheap_end < end_before + 512 * 1024 - PGSIZE)
+		panic("[ KHEAP] test 5 failed");
+	big[0] = 1;
+	big[512 * 1024 - 1] = 1;
+	kfree((void*)big);
+	if (kheap_end >= end_before + KHEAP_TRIM_THRESHOLD)
+		panic("[ KHEAP] test 5 failed");
+	serial_printf("kheap_end: %x -> %x\n", end_before, kheap_end);
+
+	// 6) ALIGNED ALLOCATIONS
+	serial_printf("\nTEST 6:\n");
+	void* al64 = kmalloc_aligned(100, 64);
+	void* al4k = kmalloc_aligned(PGSIZE, PGSIZE);
+	if (al64 == NULL || al4k == NULL || ((uintptr_t)al64 & 63)
+	    || ((uintptr_t)al4k & (PGSIZE - 1)))
+		panic("[ KHEAP] test 6 failed");
+	memset(al4k, 0xAB, PGSIZE);
+	kfree(al64);
+	kfree(al4k);
+
+	// 7) KCALLOC
+	// a dirty chunk that gets reused is cleared
+	serial_printf("\nTEST 7:\n");
+	uint8_t* dirty = (uint8_t*)kmalloc(256);
+	memset(dirty, 0xFF, 256);
+	kfree(dirty);
+	uint8_t* clean = (uint8_t*)kcalloc(64, 4);
+	if (clean == NULL)
+		panic("[ KHEAP] test 7 failed");
+	for (int i = 0; i < 256; i++)
+	{
+		if (clean[i] != 0)
+			panic("[ KHEAP] test 7 failed");
+	}
+	kfree(clean);
+
+	// 8) KREALLOC
+	// grows in place when the next chunk is free,
+	// the data survives whether it moves or not
+	serial_printf("\nTEST 8:\n");
+	uint32_t* ra = (uint32_t*)kmalloc(64);
+	ra[0] = 0x1234;
+	int in_place = !(chunk_next(payload_chunk(ra))->size & KHEAP_USED);
+	uint32_t* rr = (uint32_t*)krealloc(ra, 256);
+	if (rr == NULL || (in_place && rr != ra) || rr[0] != 0x1234)
+		panic("[ KHEAP] test 8 failed");
+	ra = rr;
+	uint32_t* rb = (uint32_t*)kmalloc(64);
+	uint32_t* rc = (uint32_t*)krealloc(ra, 1024);
+	if (rc == NULL || rc[0] != 0x1234)
+		panic("[ KHEAP] test 8 failed");
+	kfree(rb);
+	kfree(rc);
+	dbg_print_kheap();
+
+	// 9) PROFILER
+	// arr3 and str1 are the only allocations still live
+	kheap_profile_stop();
+	dbg_print_kheap_profile();
+	if (kheap_prof_live_bytes != 20 * sizeof(int) + 3400 * sizeof(char)
+	    || kheap_prof_untracked != 0)
+		panic("[ KHEAP] test 9 failed");
+
+	// 10) CONSISTENCY
+	// whatever the tests did, the heap is still well formed
+	if (kheap_check() < 0)
+		panic("[ KHEAP] test 10 failed");
+
 	return;
 }
 
 void
-kheap_init(uintptr_t kernel_end)
+kheap_init(uintptr_t base)
 {
-	// request a physical page
-	physical_page_metadata_t* pp = page_alloc();
+	base = PGROUNDUP(base);
 
-	// map such page at the next
-	// virtual page after kernel_end
-	map_pp(kern_pgdir, pp, PGROUNDUP(kernel_end));
+	// initially, just 1 page is
+	// reserved for this heap: it must
+	// be below the break before the
+	// tags are written and fault it in
+	kheap_end = base + PGSIZE - 1;
 
-	// the first chunk will begin
-	// at such page
-	chunks_free_list = (kheap_chunk_t*)PGROUNDUP(kernel_end);
-	
-	// initially, just 1 phyisical page
-	// is allocated for this heap
-	chunks_free_list->flags = 0;
-	chunks_free_list->size = PGSIZE - sizeof(kheap_chunk_t);
-	chunks_free_list->next = NULL;
+	// the prologue footer marks the space before the
+	// first chunk as used so kfree() never merges with
+	// it, and puts the payloads on 8 byte boundaries
+	uintptr_t payload = (base + sizeof(uint32_t) + KHEAP_HEADER
+	                     + KHEAP_ALIGN - 1)
+	                    & ~(KHEAP_ALIGN - 1);
+	kheap_first = payload_chunk((void*)payload);
+	*((uint32_t*)kheap_first - 1) = KHEAP_USED;
 
-	// initialize kheap_end as the last
-	// virtual address of chunks_free_list's page
-	kheap_end = (uintptr_t)chunks_free_list + PGSIZE - 1;
+	// the epilogue header takes the last bytes
+	// of the page and everything else is free
+	chunk_set(kheap_first, (uintptr_t)kheap_epilogue() - (uintptr_t)kheap_first,
+	          0);
+	class_push(kheap_first);
+	kheap_epilogue()->size = KHEAP_USED;
 
 	// run tests
 	kheap_test();
 }
 
-void
-kheap_grow()
+int
+kheap_grow(uint32_t size)
 {
-	// request a physical page
-	// from the allocator
-	physical_page_metadata_t* pp = page_alloc();
+	kheap_chunk_t* chunk = kheap_epilogue();
+	uint32_t room = KHEAP_END - 1 - kheap_end;
+
+	// a free chunk at the top already
+	// covers part of the request
+	uint32_t top = chunk_prev_tag(chunk);
+	if (!(top & KHEAP_USED))
+		size -= top & ~KHEAP_FLAGS;
 
-	// and map it as a contiguous
-	// kernel heap address
-	map_pp(kern_pgdir, pp, kheap_end + 1);
+	// a single move of the break, rounded up to
+	// KHEAP_GROW_CHUNK unless the window is almost full
+	uint32_t grow = (size + KHEAP_GROW_CHUNK - 1) & ~(KHEAP_GROW_CHUNK - 1);
+	if (grow > room)
+		grow = PGROUNDUP(size);
+	if (grow > room)
+		return -1;
 
-	// how kheap_end must point
-	// at the last address of this
-	// new virtual page
-	kheap_end += PGSIZE;
+	// the old epilogue becomes the header of a free chunk
+	// that spans the new pages, the page fault handler maps
+	// a zeroed frame the first time each of them is touched
+	// so kheap_end must point at the last address of the
+	// new virtual pages
+	kheap_end += grow;
+
+	chunk_set(chunk, grow, 0);
+	chunk_next(chunk)->size = KHEAP_USED;
+	chunk_coalesce(chunk);
+	return 0;
 }
 
-void*
-kmalloc(uint32_t size)
+// moves the heap break down when the free chunk at the top is
+// bigger than KHEAP_TRIM_THRESHOLD, keeping KHEAP_GROW_CHUNK
+// bytes of it, and gives back the frames above the new break
+static void
+kheap_trim(kheap_chunk_t* top)
+{
+	if (chunk_size(top) <= KHEAP_TRIM_THRESHOLD)
+		return;
+
+	uintptr_t brk = PGROUNDUP((uintptr_t)top + KHEAP_GROW_CHUNK);
+	uint32_t npages = (kheap_end + 1 - brk) >> PTXSHIFT;
+
+	class_remove(top);
+	kheap_end = brk - 1;
+	chunk_set(top, (uintptr_t)kheap_epilogue() - (uintptr_t)top, 0);
+	kheap_epilogue()->size = KHEAP_USED;
+	class_push(top);
+
+	// pages that were never touched have no frame
+	unmap_range_free(kern_pgdir, brk, npages);
+}
+
+// returns the size of the chunk that holds a payload of size
+// bytes: the payload plus both tags rounded up to the heap
+// alignment, 0 if it can't fit the heap window
+static uint32_t
+kheap_need(uint32_t size)
+{
+	if (size > KHEAP_END - KHEAP_BASE)
+		return 0;
+
+	uint32_t need = (size + KHEAP_TAGS + KHEAP_ALIGN - 1)
+	                & ~(KHEAP_ALIGN - 1);
+	return need < KHEAP_MIN_CHUNK ? KHEAP_MIN_CHUNK : need;
+}
+
+// marks the free chunk as not allocated anymore, merges it with
+// its free neighbours and trims the heap if it ends up on top
+static void
+chunk_release(kheap_chunk_t* chunk)
+{
+	chunk_set(chunk, chunk_size(chunk), 0);
+	chunk = chunk_coalesce(chunk);
+
+	// a free chunk at the top of the heap
+	// may be worth giving back
+	if (chunk_next(chunk) == kheap_epilogue())
+		kheap_trim(chunk);
+}
+
+// marks chunk as allocated with need bytes, the rest
+// is split off if it can hold a free chunk
+static void
+chunk_split(kheap_chunk_t* chunk, uint32_t need)
 {
-	// search for a free and large enough
-	// block using first-fit
-	kheap_chunk_t* curr = chunks_free_list;
-	while (curr != NULL)
+	uint32_t left = chunk_size(chunk) - need;
+	if (left < KHEAP_MIN_CHUNK)
 	{
-		if (!curr->flags && curr->size >= size)
-		{
-			// we've found our chunk
-			break;
-		}
-		
-		// in case we're at the end of the list
-		// without any free and large enough chunks
-		// we must grow the heap
-		if (curr->next == NULL)
-		{
-			kheap_grow();
-			
-			// update size of current chunk
-			// without advancing to the next
-			// so that we keep growing the heap
-			// untill we can either service the request
-			// or run out of physical memory
-			curr->size += PGSIZE;
-		}
-		else
+		chunk_set(chunk, chunk_size(chunk), KHEAP_USED);
+		return;
+	}
+
+	chunk_set(chunk, need, KHEAP_USED);
+	kheap_chunk_t* rest = chunk_next(chunk);
+	chunk_set(rest, left, 0);
+	chunk_release(rest);
+}
+
+// multiplicative hash of a pointer
+// to a table of n entries (a power of 2)
+static inline uint32_t
+prof_hash(const void* key, uint32_t n)
+{
+	return (((uintptr_t)key >> 3) * 2654435761u) & (n - 1);
+}
+
+// returns the stats of the callsite, NULL
+// if the table is full
+static kheap_site_t*
+prof_site(void* caller)
+{
+	uint32_t h = prof_hash(caller, KHEAP_PROF_SITES);
+
+	for (uint32_t i = 0; i < KHEAP_PROF_SITES; i++)
+	{
+		kheap_site_t* site = &kheap_sites[(h + i) & (KHEAP_PROF_SITES - 1)];
+		if (site->caller == caller)
+			return site;
+		if (site->caller == NULL)
 		{
-			// when curr isn't the last chunk
-			// we can just go to the next one
-			curr = curr->next;
+			site->caller = caller;
+			return site;
 		}
 	}
+	return NULL;
+}
 
-	// if curr is NULL we can't service
-	// the request
-	if (curr == NULL) return NULL;
+// records an allocation of size bytes at ptr made by caller
+static void
+prof_alloc(void* caller, void* ptr, uint32_t size)
+{
+	if (ptr == NULL)
+		return;
 
-	// virtual address of the next chunk
-	kheap_chunk_t* next = (kheap_chunk_t*)((uint32_t)curr + size + sizeof(kheap_chunk_t));
-	
-	// initialize the next chunk only if
-	// it is not already allocated
-	if (!next->flags)
+	kheap_site_t* site = prof_site(caller);
+	uint32_t h = prof_hash(ptr, KHEAP_PROF_LIVE);
+	kheap_live_t* live = NULL;
+	for (uint32_t i = 0; site != NULL && i < KHEAP_PROF_LIVE; i++)
 	{
-		// TODO: is -sizeof(kheap_chunk_t correct)??
-		next->size = curr->size - size - sizeof(kheap_chunk_t);
-		next->flags = 0; 	// not allocated
-		next->next = NULL;
+		live = &kheap_live[(h + i) & (KHEAP_PROF_LIVE - 1)];
+		if (live->ptr == NULL || live->ptr == KHEAP_PROF_TOMBSTONE)
+			break;
+		live = NULL;
 	}
 
-	// and update the current
-	// chunk (now allocated)
-	curr->size = size;
-	curr->flags = 1;
-	curr->next = next;
+	// without a slot the free can't be matched,
+	// so the allocation isn't counted at all
+	if (live == NULL)
+	{
+		kheap_prof_untracked++;
+		return;
+	}
+	live->ptr = ptr;
+	live->site = site;
+	live->size = size;
+
+	site->allocs++;
+	site->total_bytes += size;
+	site->live_bytes += size;
+	if (site->live_bytes > site->peak_bytes)
+		site->peak_bytes = site->live_bytes;
+	kheap_prof_live_bytes += size;
+	if (kheap_prof_live_bytes > kheap_prof_peak_bytes)
+		kheap_prof_peak_bytes = kheap_prof_live_bytes;
+}
+
+// records the free of ptr, if its allocation was recorded
+static void
+prof_free(void* ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	uint32_t h = prof_hash(ptr, KHEAP_PROF_LIVE);
+	for (uint32_t i = 0; i < KHEAP_PROF_LIVE; i++)
+	{
+		kheap_live_t* live = &kheap_live[(h + i) & (KHEAP_PROF_LIVE - 1)];
+		if (live->ptr == NULL)
+			return;
+		if (live->ptr != ptr)
+			continue;
+
+		live->site->frees++;
+		live->site->live_bytes -= live->size;
+		kheap_prof_live_bytes -= live->size;
+		live->ptr = KHEAP_PROF_TOMBSTONE;
+		return;
+	}
+}
+
+static void*
+kheap_alloc(uint32_t size)
+{
+	uint32_t need = kheap_need(size);
+	if (need == 0)
+		return NULL;
+
+	// look for a free and large enough chunk in the size
+	// class lists, otherwise grow the heap enough for it
+	// in one go or fail if we run out of virtual memory
+	kheap_chunk_t* curr = chunk_find(need);
+	if (curr == NULL)
+	{
+		if (kheap_grow(need) < 0)
+			return NULL;
+		curr = chunk_find(need);
+	}
+
+	// split the chunk if the rest can hold a free chunk
+	chunk_split(curr, need);
 
 	// return the first byte after
 	// the chunk header
-	return (void*)(curr + 1);
+	return chunk_payload(curr);
 }
 
-void
-kfree(void *ptr)
+void*
+kmalloc(uint32_t size)
+{
+	void* ptr = kheap_alloc(size);
+
+	if (kheap_profiling)
+		prof_alloc(__builtin_return_address(0), ptr, size);
+	return ptr;
+}
+
+static void
+kheap_free(void *ptr)
 {
+	if (ptr == NULL) return;
+
 	// get a pointer to the
 	// chunk header
-	kheap_chunk_t* chunk = (kheap_chunk_t*)(ptr - sizeof(kheap_chunk_t));
+	kheap_chunk_t* chunk = payload_chunk(ptr);
 	
 	// reject not-allocated
 	// chunks
-	if (!chunk->flags) return;
+	if (!(chunk->size & KHEAP_USED)) return;
 
 	// mark chunk as not allocated
-	// anymore
-	chunk->flags = 0;
+	// anymore and merge it with his
+	// free neighbours
+	chunk_release(chunk);
+}
+
+void
+kfree(void *ptr)
+{
+	if (kheap_profiling)
+		prof_free(ptr);
+	kheap_free(ptr);
+}
 
-	// coalesce the free list of chunks
-	// NOTE: we need a full traversal
-	chunk = chunks_free_list;
-	while (chunk->next != NULL)
+static void*
+kheap_alloc_aligned(uint32_t size, uint32_t align)
+{
+	// every payload is already aligned to KHEAP_ALIGN
+	if (align <= KHEAP_ALIGN)
+		return kheap_alloc(size);
+	if ((align & (align - 1)) || size > KHEAP_END - KHEAP_BASE - align)
+		return NULL;
+
+	// leave room for the worst case gap in front
+	// of the aligned payload, which must be able
+	// to hold a free chunk, and for a chunk of at
+	// least KHEAP_MIN_CHUNK bytes after it
+	uint32_t room = size < KHEAP_MIN_CHUNK ? KHEAP_MIN_CHUNK : size;
+	uint8_t* ptr = (uint8_t*)kheap_alloc(room + align + KHEAP_MIN_CHUNK);
+	if (ptr == NULL)
+		return NULL;
+
+	kheap_chunk_t* chunk = payload_chunk(ptr);
+	uintptr_t aligned = ((uintptr_t)ptr + align - 1) & ~(align - 1);
+	if (aligned != (uintptr_t)ptr)
 	{
-		// is his neighboor chunk free too?
-		// if yes then coalesce those
-		if (!chunk->flags && !chunk->next->flags)
+		while (aligned - (uintptr_t)ptr < KHEAP_MIN_CHUNK)
+			aligned += align;
+
+		// the gap becomes a free chunk
+		// of its own, set the aligned
+		// one first so they don't merge
+		uint32_t gap = aligned - (uintptr_t)ptr;
+		kheap_chunk_t* achunk = payload_chunk((void*)aligned);
+		chunk_set(achunk, chunk_size(chunk) - gap, KHEAP_USED);
+		chunk_set(chunk, gap, 0);
+		chunk_release(chunk);
+		chunk = achunk;
+	}
+
+	// give back the tail that isn't needed
+	chunk_split(chunk, kheap_need(size));
+	return chunk_payload(chunk);
+}
+
+void*
+kmalloc_aligned(uint32_t size, uint32_t align)
+{
+	void* ptr = kheap_alloc_aligned(size, align);
+
+	if (kheap_profiling)
+		prof_alloc(__builtin_return_address(0), ptr, size);
+	return ptr;
+}
+
+void*
+kcalloc(uint32_t n, uint32_t size)
+{
+	// n * size must not overflow
+	if (size != 0 && n > 0xFFFFFFFF / size)
+		return NULL;
+
+	uint32_t total = n * size;
+	uint8_t* ptr = (uint8_t*)kheap_alloc(total);
+	if (ptr == NULL)
+		return NULL;
+	if (kheap_profiling)
+		prof_alloc(__builtin_return_address(0), ptr, total);
+
+	// pages that were never touched are still unmapped:
+	// the page fault handler backs them with zeroed frames,
+	// so only the pages that are mapped need clearing
+	uintptr_t va = (uintptr_t)ptr, end = va + total;
+	while (va < end)
+	{
+		uintptr_t next = PGROUNDDOWN(va) + PGSIZE;
+		if (next > end)
+			next = end;
+		if (va_to_pa(kern_pgdir, va))
+			memset((void*)va, 0, next - va);
+		va = next;
+	}
+	return ptr;
+}
+
+static void*
+kheap_realloc(void* ptr, uint32_t size)
+{
+	if (ptr == NULL)
+		return kheap_alloc(size);
+	if (size == 0)
+	{
+		kheap_free(ptr);
+		return NULL;
+	}
+
+	kheap_chunk_t* chunk = payload_chunk(ptr);
+	uint32_t need = kheap_need(size);
+	if (need == 0 || !(chunk->size & KHEAP_USED))
+		return NULL;
+
+	// at the top of the heap the break can
+	// move up to make room right after ptr
+	kheap_chunk_t* next = chunk_next(chunk);
+	if (next == kheap_epilogue() && chunk_size(chunk) < need)
+	{
+		if (kheap_grow(need - chunk_size(chunk)) < 0)
+			return NULL;
+		next = chunk_next(chunk);
+	}
+
+	// grow in place by taking over
+	// the free chunk that follows
+	if (chunk_size(chunk) < need && !(next->size & KHEAP_USED)
+	    && chunk_size(chunk) + chunk_size(next) >= need)
+	{
+		class_remove(next);
+		chunk_set(chunk, chunk_size(chunk) + chunk_size(next), KHEAP_USED);
+	}
+
+	// shrinking or growing in place
+	if (chunk_size(chunk) >= need)
+	{
+		chunk_split(chunk, need);
+		return ptr;
+	}
+
+	// otherwise move the data to a new chunk
+	void* new_ptr = kheap_alloc(size);
+	if (new_ptr == NULL)
+		return NULL;
+	memcpy(new_ptr, ptr, chunk_size(chunk) - KHEAP_TAGS);
+	kheap_free(ptr);
+	return new_ptr;
+}
+
+void*
+krealloc(void* ptr, uint32_t size)
+{
+	void* new_ptr = kheap_realloc(ptr, size);
+
+	// on failure ptr is still allocated
+	if (kheap_profiling && (new_ptr != NULL || size == 0))
+	{
+		prof_free(ptr);
+		prof_alloc(__builtin_return_address(0), new_ptr, size);
+	}
+	return new_ptr;
+}
+
+void
+kheap_profile_start()
+{
+	memset(kheap_sites, 0, sizeof(kheap_sites));
+	memset(kheap_live, 0, sizeof(kheap_live));
+	kheap_prof_live_bytes = 0;
+	kheap_prof_peak_bytes = 0;
+	kheap_prof_untracked = 0;
+	kheap_profiling = 1;
+}
+
+void
+kheap_profile_stop()
+{
+	kheap_profiling = 0;
+}
+
+void
+kheap_fragmentation(kheap_frag_t* frag)
+{
+	frag->heap_bytes = kheap_end + 1 - KHEAP_BASE;
+	frag->free_bytes = 0;
+	frag->free_chunks = 0;
+	frag->largest_free = 0;
+
+	// only the free lists are walked, the
+	// sizes include the boundary tags
+	for (uint32_t class = 0; class < KHEAP_NCLASSES; class++)
+	{
+		for (kheap_chunk_t* c = kheap_classes[class]; c != NULL; c = c->next)
+		{
+			uint32_t size = chunk_size(c);
+			frag->free_bytes += size;
+			frag->free_chunks++;
+			if (size > frag->largest_free)
+				frag->largest_free = size;
+		}
+	}
+}
+
+void
+dbg_print_kheap_profile()
+{
+	kheap_frag_t frag;
+
+	serial_printf("== KHEAP PROFILE ==\n");
+	serial_printf("live: %d, peak: %d, untracked allocs: %d\n",
+	              kheap_prof_live_bytes, kheap_prof_peak_bytes,
+	              kheap_prof_untracked);
+
+	// one line per callsite
+	for (uint32_t i = 0; i < KHEAP_PROF_SITES; i++)
+	{
+		kheap_site_t* site = &kheap_sites[i];
+		if (site->caller == NULL)
+			continue;
+		serial_printf("%x: allocs %d frees %d live %d peak %d total %d\n",
+		              site->caller, site->allocs, site->frees,
+		              site->live_bytes, site->peak_bytes,
+		              site->total_bytes);
+	}
+
+	// 0 when all the free memory is a single
+	// chunk, close to 100 when it is scattered
+	kheap_fragmentation(&frag);
+	serial_printf("heap: %d, free: %d in %d chunks, largest: %d, "
+	              "fragmentation: %d percent\n",
+	              frag.heap_bytes, frag.free_bytes, frag.free_chunks,
+	              frag.largest_free,
+	              frag.free_bytes ? 100 - frag.largest_free * 100
+	                                          / frag.free_bytes
+	                              : 0);
+}
+
+// logs the broken invariant of kheap_check()
+static int
+kheap_check_failed(const char* what, kheap_chunk_t* chunk)
+{
+	serial_printf("[LOG] kheap_check: %s at %x\n", what, chunk);
+	return -1;
+}
+
+int
+kheap_check()
+{
+	kheap_chunk_t* epilogue = kheap_epilogue();
+	kheap_chunk_t* curr = kheap_first;
+	uint32_t nfree = 0, nlisted = 0;
+	int prev_free = 0;
+
+	if (!(chunk_prev_tag(kheap_first) & KHEAP_USED))
+		return kheap_check_failed("free prologue", kheap_first);
+
+	// walk the chunks in address order: the tags must match
+	// and two free chunks can never be next to each other
+	while ((uintptr_t)curr < (uintptr_t)epilogue)
+	{
+		uint32_t size = chunk_size(curr);
+
+		if (size < KHEAP_MIN_CHUNK || (size & (KHEAP_ALIGN - 1))
+		    || (uintptr_t)curr + size > (uintptr_t)epilogue)
+			return kheap_check_failed("bad size", curr);
+		if ((uintptr_t)chunk_payload(curr) & (KHEAP_ALIGN - 1))
+			return kheap_check_failed("misaligned payload", curr);
+		if (*chunk_footer(curr) != curr->size)
+			return kheap_check_failed("footer mismatch", curr);
+		if (!(curr->size & KHEAP_USED))
 		{
-			// update size of the first chunk
-			// to "include" the second one
-			chunk->size += chunk->next->size + sizeof(kheap_chunk_t);
-			// actually delete the second chunk
-			chunk->next = chunk->next->next;
+			if (prev_free)
+				return kheap_check_failed("free chunks not merged", curr);
+			nfree++;
 		}
-		else 
+		prev_free = !(curr->size & KHEAP_USED);
+		curr = chunk_next(curr);
+	}
+	if (curr != epilogue || epilogue->size != KHEAP_USED)
+		return kheap_check_failed("bad epilogue", curr);
+
+	// every free chunk must be on the list of its class,
+	// which is marked in the bitmap when it isn't empty
+	for (uint32_t class = 0; class < KHEAP_NCLASSES; class++)
+	{
+		kheap_chunk_t* prev = NULL;
+
+		int marked = (kheap_classes_map >> class) & 1;
+		if (marked != (kheap_classes[class] != NULL))
+			return kheap_check_failed("bad class bitmap", prev);
+		for (kheap_chunk_t* c = kheap_classes[class]; c != NULL; c = c->next)
 		{
-			// otherwise advance to the next chunk
-			chunk = chunk->next;
+			if ((c->size & KHEAP_USED)
+			    || kheap_class(chunk_size(c)) != class || c->prev != prev
+			    || ++nlisted > nfree)
+				return kheap_check_failed("bad free list", c);
+			prev = c;
 		}
 	}
+	if (nlisted != nfree)
+		return kheap_check_failed("free chunk not listed", NULL);
+	return 0;
 }
 
 void
 dbg_print_kheap()
 {
-	// start from the first chunk
-	kheap_chunk_t* curr = chunks_free_list;
+	// walk the chunks in address order,
+	// up to the epilogue
+	kheap_chunk_t* curr = kheap_first;
 	uintptr_t start, end;
 	uint32_t size;
 	int i = 0;
 	
-	while(curr != NULL)
+	while (chunk_size(curr) != 0)
 	{
-		start = (uintptr_t)curr + sizeof(kheap_chunk_t);
-		size = curr->size;
+		start = (uintptr_t)chunk_payload(curr);
+		size = chunk_size(curr) - KHEAP_TAGS;
 		end = start + size - 1; // actual end
 		
 		serial_printf("== CHUNK %d ==\n", i);
 		serial_printf("start: %x\nsize:%d\nend: %x\n", start, size, end);
 
-		if (curr->flags)
+		if (curr->size & KHEAP_USED)
 			serial_printf("allocated\n");
 		else
 		 	serial_printf("unallocated\n");
 
 		// advance to next chunk
-		curr = curr->next;
+		curr = chunk_next(curr);
 		++i;
 	}
 }
@@ -0,0 +1,127 @@
+#include <learnix/cpu.h>
+#include <learnix/ktime.h>
+#include <learnix/pit.h>
+#include <learnix/timer.h>
+#include <learnix/x86/x86.h>
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t tsc_khz;
+uint32_t tsc_mult;
+uint32_t tsc_shift;
+
+// TSC at ktime_init(), time 0
+static uint64_t tsc_base;
+
+static uint64_t ktime_ticks();
+static uint64_t ktime_tsc();
+
+// clocksource of ktime_ns(), the TSC once calibrated
+static uint64_t (*ktime_read)() = ktime_ticks;
+
+// returns the TSC cycles of the shortest calibration run
+static uint64_t
+tsc_calibrate()
+{
+	uint64_t best = ~0ULL;
+
+	for (uint32_t run = 0; run < TSC_CALIBRATE_RUNS; run++)
+	{
+		uint32_t eflags = read_eflags();
+		cli();
+		uint64_t start = read_tsc();
+		pit_ch2_wait(PIT_FREQ / TSC_CALIBRATE_HZ);
+		uint64_t cycles = read_tsc() - start;
+		write_eflags(eflags);
+
+		if (cycles < best)
+			best = cycles;
+	}
+	return best;
+}
+
+// picks the largest shift that keeps tsc_mult in 32 bits,
+// the larger the shift the more precise the conversion
+static void
+tsc_mult_setup()
+{
+	for (tsc_shift = 32; tsc_shift > 0; tsc_shift--)
+	{
+		uint64_t mult = (1000000ULL << tsc_shift) / tsc_khz;
+		if (mult <= 0xFFFFFFFF)
+		{
+			tsc_mult = mult;
+			return;
+		}
+	}
+}
+
+void
+ktime_init()
+{
+	if (!cpu_has(CPU_FEATURE_TSC))
+		return;
+
+	// the PIT counts PIT_FREQ / TSC_CALIBRATE_HZ cycles,
+	// which isn't exactly 1 / TSC_CALIBRATE_HZ seconds
+	uint64_t cycles = tsc_calibrate();
+	uint32_t count = PIT_FREQ / TSC_CALIBRATE_HZ;
+	tsc_khz = cycles * PIT_FREQ / ((uint64_t)count * 1000);
+	if (tsc_khz == 0)
+		return;
+
+	tsc_mult_setup();
+	tsc_base = read_tsc();
+	ktime_read = ktime_tsc;
+}
+
+static uint64_t
+ktime_ticks()
+{
+	return timer_ticks() * (NSEC_PER_SEC / TIMER_HZ);
+}
+
+static uint64_t
+ktime_tsc()
+{
+	return cyc2ns(read_tsc() - tsc_base);
+}
+
+uint64_t
+ktime_ns()
+{
+	return ktime_read();
+}
+
+static void
+tsc_delay(uint64_t cycles)
+{
+	uint64_t start = read_tsc();
+
+	while (read_tsc() - start < cycles)
+		asm volatile("pause");
+}
+
+void
+udelay(uint32_t us)
+{
+	if (tsc_khz == 0)
+	{
+		// a port 0x80 write takes about a microsecond
+		while (us--)
+			io_wait();
+		return;
+	}
+	tsc_delay((uint64_t)us * tsc_khz / 1000);
+}
+
+void
+ndelay(uint32_t ns)
+{
+	if (tsc_khz == 0)
+	{
+		udelay((ns + NSEC_PER_USEC - 1) / NSEC_PER_USEC);
+		return;
+	}
+	tsc_delay(((uint64_t)ns * tsc_khz + 999999) / 1000000);
+}
@@ -1,15 +1,29 @@
+#include <learnix/ktime.h>
 #include <learnix/pic.h>
 #include <learnix/x86/x86.h>
 #include <stdint.h>
 
+/* remaps the PIC offsets to enable its use in protected mode */
+static void pic_remap(int master_offset, int slave_offset);
+
 void
 pic_init()
 {
 	// remap the PICs offset since we're in protected mode
 	pic_remap(PIC1_OFFSET, PIC2_OFFSET);
 
-	// enable IRQ1 (keyboard line)
-	pic_set_mask(1);
+	// mask every line but IRQ1 (keyboard line)
+	pic_disable();
+	pic_clear_mask(1);
+}
+
+void
+pic_disable()
+{
+	// masking every line of both PICs also
+	// keeps them from raising spurious IRQs
+	outb(PIC1_DATA, 0xFF);
+	outb(PIC2_DATA, 0xFF);
 }
 
 static void
@@ -24,36 +38,36 @@ pic_remap(int pic1_offset, int pic2_offset)
 
 	// ICW1: start the initialization sequence
 	outb(PIC1_COMMAND, ICW1_INIT | ICW1_ICW4);
-	io_wait();
+	udelay(PIC_DELAY_US);
 	outb(PIC2_COMMAND, ICW1_INIT | ICW1_ICW4);
-	io_wait();
+	udelay(PIC_DELAY_US);
 
 	// ICW2: configure master PIC vector offset
 	outb(PIC1_DATA, pic1_offset);
-	io_wait();
+	udelay(PIC_DELAY_US);
 	// ICW2: configure slave PIC vector offset
 	outb(PIC2_DATA, pic2_offset);
-	io_wait();
+	udelay(PIC_DELAY_US);
 
 	// ICW3: tell master PIC that there is a slave PIC at IRQ2 (0x4)
-	outb(PIC1_DATA, 4);
-	io_wait();
+	outb(PIC1_DATA, 1 << PIC_CASCADE_IRQ);
+	udelay(PIC_DELAY_US);
 	// ICW3: tell slave PIC its cascade identity (0x2)
 	outb(PIC2_DATA, 2);
 
 	// ICW4: have the PICs use 8086 mode (rather than the default 8080
 	// mode)
 	outb(PIC1_DATA, ICW4_8086);
-	io_wait();
+	udelay(PIC_DELAY_US);
 	outb(PIC2_DATA, ICW4_8086);
-	io_wait();
+	udelay(PIC_DELAY_US);
 
 	// restore saved masks
 	outb(PIC1_DATA, mask1);
 	outb(PIC2_DATA, mask2);
 }
 
-static void
+void
 pic_set_mask(uint8_t irq_line)
 {
 	uint16_t port;
@@ -72,12 +86,12 @@ pic_set_mask(uint8_t irq_line)
 	}
 
 	// the new mask for the PIC will have the irq_line bit set to 1
-	value = inb(port) || (1 << irq_line);
+	value = inb(port) | (1 << irq_line);
 	// write the new mask on the PIC
 	outb(port, value);
 }
 
-static void
+void
 pic_clear_mask(uint8_t irq_line)
 {
 	uint16_t port;
@@ -112,4 +126,16 @@ pic_send_eoi(uint8_t irq)
 	if (irq >= 8)
 		outb(PIC2_COMMAND, PIC_EOI);
 	outb(PIC1_COMMAND, PIC_EOI);
-}
\ No newline at end of file
+}
+
+/*
+ * the in-service register has a bit set for each IRQ the PIC delivered and
+ * that hasn't been acknowledged yet, a spurious IRQ doesn't set any
+ */
+uint16_t
+pic_get_isr()
+{
+	outb(PIC1_COMMAND, PIC_READ_ISR);
+	outb(PIC2_COMMAND, PIC_READ_ISR);
+	return (inb(PIC2_COMMAND) << 8) | inb(PIC1_COMMAND);
+}
@@ -0,0 +1,76 @@
+#include <learnix/pit.h>
+#include <learnix/x86/x86.h>
+#include <stdint.h>
+
+static void pit_set_periodic(uint32_t count);
+static void pit_set_oneshot(uint32_t count);
+static uint32_t pit_elapsed();
+
+clock_event_t pit_clock_event = {
+	.name = "pit",
+	.freq = PIT_FREQ,
+	.max_delta = 0xFFFF,
+	.set_periodic = pit_set_periodic,
+	.set_oneshot = pit_set_oneshot,
+	.elapsed = pit_elapsed,
+};
+
+// count of the last pit_set_*() call
+static uint32_t pit_count;
+
+static void
+pit_load(uint8_t mode, uint32_t count)
+{
+	pit_count = count;
+	outb(PIT_COMMAND, PIT_SEL_CH0 | PIT_LOHI | mode);
+	// a count of 0 stands for 65536
+	outb(PIT_CH0, count & 0xFF);
+	outb(PIT_CH0, count >> 8 & 0xFF);
+}
+
+static void
+pit_set_periodic(uint32_t count)
+{
+	pit_load(PIT_MODE2, count);
+}
+
+static void
+pit_set_oneshot(uint32_t count)
+{
+	// the count starts as soon as its high byte is written
+	pit_load(PIT_MODE0, count);
+}
+
+static uint32_t
+pit_elapsed()
+{
+	// latch the status and the count of channel 0 together
+	outb(PIT_COMMAND, PIT_READBACK | PIT_RB_CH0);
+	uint8_t status = inb(PIT_CH0);
+	uint32_t count = inb(PIT_CH0);
+	count |= inb(PIT_CH0) << 8;
+
+	// in mode 0 the output goes high at the terminal count, then the
+	// counter keeps wrapping around: that tells how late the interrupt
+	// is served, as long as it's less than 65536 cycles
+	if ((status & 0x0E) == PIT_MODE0 && (status & PIT_STATUS_OUT))
+		return pit_count + ((0x10000 - count) & 0xFFFF);
+	return count <= pit_count ? pit_count - count : 0;
+}
+
+void
+pit_ch2_wait(uint16_t count)
+{
+	uint8_t ctl = inb(PIT_CH2_GATE);
+
+	// speaker off, gate on
+	outb(PIT_CH2_GATE, (ctl & ~PIT_SPEAKER) | PIT_GATE2);
+	outb(PIT_COMMAND, PIT_SEL_CH2 | PIT_LOHI | PIT_MODE0);
+	outb(PIT_CH2, count & 0xFF);
+	outb(PIT_CH2, count >> 8);
+
+	// OUT2 goes high at the terminal count
+	while (!(inb(PIT_CH2_GATE) & PIT_OUT2))
+		;
+	outb(PIT_CH2_GATE, ctl & ~PIT_SPEAKER);
+}
@@ -0,0 +1,25 @@
+#include <learnix/simd.h>
+#include <learnix/x86/mmu.h>
+#include <stdint.h>
+
+void
+simd_clear_page(void *page)
+{
+	uint32_t lines = PGSIZE / 64;
+
+	// a cache line per iteration, the non-temporal
+	// stores are weakly ordered: sfence at the end
+	asm volatile("pxor %%xmm0, %%xmm0\n"
+	             "1:\n\t"
+	             "movntdq %%xmm0, (%0)\n\t"
+	             "movntdq %%xmm0, 16(%0)\n\t"
+	             "movntdq %%xmm0, 32(%0)\n\t"
+	             "movntdq %%xmm0, 48(%0)\n\t"
+	             "add $64, %0\n\t"
+	             "dec %1\n\t"
+	             "jnz 1b\n\t"
+	             "sfence"
+	             : "+r"(page), "+r"(lines)
+	             :
+	             : "xmm0", "cc", "memory");
+}
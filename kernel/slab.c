@@ -0,0 +1,309 @@
+#include <learnix/drivers/serial.h>
+#include <learnix/slab.h>
+#include <learnix/vm.h>
+#include <learnix/x86/mmu.h>
+#include <learnix/x86/x86.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define KMEM_ALIGN(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+// the caches themselves are objects of this cache,
+// which is the only one that isn't created at runtime
+static kmem_cache_t kmem_cache_cache = {
+	.name = "kmem_cache",
+	.size = sizeof(kmem_cache_t),
+	.slot = KMEM_ALIGN(sizeof(kmem_cache_t), sizeof(void *)),
+	.offset = 0,
+	.first = KMEM_ALIGN(sizeof(kmem_slab_t), sizeof(void *)),
+	.objs_per_slab
+	    = (PGSIZE - KMEM_ALIGN(sizeof(kmem_slab_t), sizeof(void *)))
+	      / KMEM_ALIGN(sizeof(kmem_cache_t), sizeof(void *)),
+};
+
+// returns the link to the next free object stored inside obj
+static inline void **
+obj_link(kmem_cache_t *cache, void *obj)
+{
+	return (void **)((uintptr_t)obj + cache->offset);
+}
+
+static void
+slab_list_push(kmem_slab_t **list, kmem_slab_t *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if (slab->next != NULL)
+		slab->next->prev = slab;
+	*list = slab;
+}
+
+static void
+slab_list_remove(kmem_slab_t **list, kmem_slab_t *slab)
+{
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+	slab->next = NULL;
+	slab->prev = NULL;
+}
+
+// carves a new frame in objects and threads them
+// on its freelist, NULL if out of physical pages
+static kmem_slab_t *
+slab_create(kmem_cache_t *cache)
+{
+	physical_page_metadata_t *pp = page_alloc_order(0);
+	if (pp == NULL)
+		return NULL;
+
+	// page_alloc_order() only returns physmap frames
+	kmem_slab_t *slab = pp2kva(pp);
+	slab->cache = cache;
+	slab->inuse = 0;
+	slab->free = NULL;
+
+	// link the objects backwards so that the
+	// first one is handed out first
+	for (uint32_t i = cache->objs_per_slab; i > 0; i--)
+	{
+		void *obj = (void *)((uintptr_t)slab + cache->first
+		                     + (i - 1) * cache->slot);
+		if (cache->ctor != NULL)
+			cache->ctor(obj);
+		*obj_link(cache, obj) = slab->free;
+		slab->free = obj;
+	}
+
+	cache->nslabs++;
+	return slab;
+}
+
+static void
+slab_destroy(kmem_cache_t *cache, kmem_slab_t *slab)
+{
+	page_free(pa2pp(kva2pa((uintptr_t)slab)));
+	cache->nslabs--;
+}
+
+kmem_cache_t *
+kmem_cache_create(const char *name, uint32_t size, uint32_t align,
+                  void (*ctor)(void *))
+{
+	if (align == 0)
+		align = sizeof(void *);
+	if (size == 0 || size > KMEM_MAX_OBJ_SIZE || (align & (align - 1))
+	    || align > KMEM_MAX_OBJ_SIZE)
+		return NULL;
+
+	// free objects keep the freelist link in their first word,
+	// unless a constructor set them up: then the link goes
+	// after the object, where it can't clobber its state
+	uint32_t offset, slot;
+	if (ctor != NULL)
+	{
+		offset = KMEM_ALIGN(size, sizeof(void *));
+		slot = offset + sizeof(void *);
+	}
+	else
+	{
+		offset = 0;
+		slot = size < sizeof(void *) ? sizeof(void *) : size;
+	}
+	slot = KMEM_ALIGN(slot, align);
+	uint32_t first = KMEM_ALIGN(sizeof(kmem_slab_t), align);
+	if ((PGSIZE - first) / slot < KMEM_MIN_OBJS_PER_SLAB)
+		return NULL;
+
+	kmem_cache_t *cache = kmem_cache_alloc(&kmem_cache_cache);
+	if (cache == NULL)
+		return NULL;
+
+	cache->name = name;
+	cache->size = size;
+	cache->ctor = ctor;
+	cache->offset = offset;
+	cache->slot = slot;
+	cache->first = first;
+	cache->objs_per_slab = (PGSIZE - first) / slot;
+
+	cache->partial = NULL;
+	cache->empty = NULL;
+	cache->nslabs = 0;
+	cache->nactive = 0;
+	return cache;
+}
+
+void *
+kmem_cache_alloc(kmem_cache_t *cache)
+{
+	// caches can be used by interrupt handlers
+	uint32_t eflags = read_eflags();
+	cli();
+
+	kmem_slab_t *slab = cache->partial;
+	if (slab == NULL)
+	{
+		// reuse the empty slab before asking for a new frame
+		slab = cache->empty != NULL ? cache->empty : slab_create(cache);
+		cache->empty = NULL;
+		if (slab == NULL)
+		{
+			write_eflags(eflags);
+			return NULL;
+		}
+		slab_list_push(&cache->partial, slab);
+	}
+
+	// pop the first free object
+	void *obj = slab->free;
+	slab->free = *obj_link(cache, obj);
+	slab->inuse++;
+	cache->nactive++;
+
+	// full slabs aren't on any list, kmem_cache_free()
+	// puts them back on the partial one
+	if (slab->free == NULL)
+		slab_list_remove(&cache->partial, slab);
+
+	write_eflags(eflags);
+	return obj;
+}
+
+void
+kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+	kmem_slab_t *slab = (kmem_slab_t *)PGROUNDDOWN((uintptr_t)obj);
+
+	// reject objects of other caches
+	if (obj == NULL || slab->cache != cache)
+	{
+		serial_printf("[LOG] kmem_cache_free: %x isn't from %s\n", obj,
+		              cache->name);
+		return;
+	}
+
+	uint32_t eflags = read_eflags();
+	cli();
+
+	if (slab->free == NULL)
+		slab_list_push(&cache->partial, slab);
+	*obj_link(cache, obj) = slab->free;
+	slab->free = obj;
+	slab->inuse--;
+	cache->nactive--;
+
+	// keep a single empty slab to absorb alloc/free
+	// bursts, the frames of the others go back
+	if (slab->inuse == 0)
+	{
+		slab_list_remove(&cache->partial, slab);
+		if (cache->empty == NULL)
+			cache->empty = slab;
+		else
+			slab_destroy(cache, slab);
+	}
+
+	write_eflags(eflags);
+}
+
+int
+kmem_cache_destroy(kmem_cache_t *cache)
+{
+	uint32_t eflags = read_eflags();
+	cli();
+
+	// full slabs aren't on any list, the
+	// objects must all be given back first
+	if (cache->nactive != 0)
+	{
+		write_eflags(eflags);
+		serial_printf("[LOG] kmem_cache_destroy: %s has %d objects\n",
+		              cache->name, cache->nactive);
+		return -1;
+	}
+
+	if (cache->empty != NULL)
+		slab_destroy(cache, cache->empty);
+	cache->empty = NULL;
+	write_eflags(eflags);
+
+	kmem_cache_free(&kmem_cache_cache, cache);
+	return 0;
+}
+
+void
+dbg_print_kmem_cache(kmem_cache_t *cache)
+{
+	serial_printf("== CACHE %s ==\n", cache->name);
+	serial_printf("object size: %d, slot: %d, objects per slab: %d\n",
+	              cache->size, cache->slot, cache->objs_per_slab);
+	serial_printf("slabs: %d, active objects: %d\n", cache->nslabs,
+	              cache->nactive);
+}
+
+static uint32_t kmem_test_ctor_calls;
+
+static void
+kmem_test_ctor(void *obj)
+{
+	*(uint32_t *)obj = 0xCAFE;
+	kmem_test_ctor_calls++;
+}
+
+static void
+kmem_cache_test()
+{
+	// 1) objects are aligned and distinct, the
+	// constructor ran once per object of the slab
+	kmem_cache_t *cache = kmem_cache_create("test", 40, KMEM_CACHE_LINE,
+	                                        kmem_test_ctor);
+	if (cache == NULL)
+		panic("[ SLAB ] test 1 failed");
+	uint32_t *obj1 = kmem_cache_alloc(cache);
+	uint32_t *obj2 = kmem_cache_alloc(cache);
+	if (obj1 == NULL || obj2 == NULL || obj1 == obj2
+	    || ((uintptr_t)obj1 & (KMEM_CACHE_LINE - 1))
+	    || ((uintptr_t)obj2 & (KMEM_CACHE_LINE - 1)) || *obj1 != 0xCAFE
+	    || kmem_test_ctor_calls != cache->objs_per_slab)
+		panic("[ SLAB ] test 1 failed");
+
+	// 2) a freed object is handed out again
+	// without running the constructor
+	kmem_cache_free(cache, obj2);
+	if (kmem_cache_alloc(cache) != obj2 || *obj2 != 0xCAFE
+	    || kmem_test_ctor_calls != cache->objs_per_slab)
+		panic("[ SLAB ] test 2 failed");
+
+	// 3) filling a slab creates a new one
+	static void *objs[PGSIZE / KMEM_CACHE_LINE + 1];
+	uint32_t n = 0;
+	objs[n++] = obj1;
+	objs[n++] = obj2;
+	while (n <= cache->objs_per_slab)
+		objs[n++] = kmem_cache_alloc(cache);
+	if (cache->nslabs != 2)
+		panic("[ SLAB ] test 3 failed");
+	dbg_print_kmem_cache(cache);
+
+	// 4) the cache is destroyed once its objects are back,
+	// which gives the frames of its slabs back too
+	if (kmem_cache_destroy(cache) != -1)
+		panic("[ SLAB ] test 4 failed");
+	while (n > 0)
+		kmem_cache_free(cache, objs[--n]);
+	if (cache->nactive != 0 || cache->nslabs != 1
+	    || kmem_cache_destroy(cache) != 0)
+		panic("[ SLAB ] test 4 failed");
+}
+
+void
+kmem_cache_init()
+{
+	// run tests
+	kmem_cache_test();
+}
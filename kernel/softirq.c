@@ -0,0 +1,109 @@
+#include <learnix/irqstat.h>
+#include <learnix/softirq.h>
+#include <learnix/x86/x86.h>
+#include <stddef.h>
+#include <stdint.h>
+
+volatile uint32_t softirq_pending;
+
+// set while do_softirq() runs, so that the
+// interrupts it lets in don't start it again
+static uint32_t softirq_active;
+
+// scheduled tasklets, in order
+static tasklet_t *tasklet_head;
+static tasklet_t **tasklet_tail = &tasklet_head;
+
+static void tasklet_action();
+
+static void (*softirq_vec[NR_SOFTIRQS])() = {
+	[TASKLET_SOFTIRQ] = tasklet_action,
+};
+
+void
+open_softirq(uint32_t nr, void (*fn)())
+{
+	softirq_vec[nr] = fn;
+}
+
+void
+raise_softirq(uint32_t nr)
+{
+	uint32_t eflags = read_eflags();
+	cli();
+	softirq_pending |= 1u << nr;
+	write_eflags(eflags);
+}
+
+void
+do_softirq()
+{
+	if (softirq_active)
+		return;
+	softirq_active = 1;
+
+	for (uint32_t restart = 0;
+	     restart < SOFTIRQ_MAX_RESTART && softirq_pending != 0; restart++)
+	{
+		uint32_t pending = softirq_pending;
+		softirq_pending = 0;
+
+		sti();
+		while (pending != 0)
+		{
+			uint32_t nr = __builtin_ctz(pending);
+			pending &= pending - 1;
+			if (softirq_vec[nr] != NULL)
+				softirq_vec[nr]();
+		}
+		cli();
+	}
+
+	softirq_active = 0;
+}
+
+void
+tasklet_schedule(tasklet_t *tasklet)
+{
+	uint32_t eflags = read_eflags();
+	cli();
+	if (!tasklet->scheduled)
+	{
+		tasklet->scheduled = 1;
+		tasklet->next = NULL;
+		*tasklet_tail = tasklet;
+		tasklet_tail = &tasklet->next;
+		softirq_pending |= 1u << TASKLET_SOFTIRQ;
+	}
+	write_eflags(eflags);
+}
+
+// runs the tasklets scheduled so far, the
+// ones they schedule wait for the next round
+static void
+tasklet_action()
+{
+	cli();
+	tasklet_t *tasklet = tasklet_head;
+	tasklet_head = NULL;
+	tasklet_tail = &tasklet_head;
+	sti();
+
+	while (tasklet != NULL)
+	{
+		tasklet_t *next = tasklet->next;
+
+		// scheduling it again from now on queues it again
+		tasklet->scheduled = 0;
+		if (irqstat_enabled)
+		{
+			uint64_t tsc = read_tsc();
+			tasklet->fn(tasklet->ctx);
+			irqstat_soft(tasklet->vector, read_tsc() - tsc);
+		}
+		else
+			tasklet->fn(tasklet->ctx);
+
+		tasklet = next;
+	}
+}
@@ -0,0 +1,396 @@
+#include <learnix/apic.h>
+#include <learnix/drivers/serial.h>
+#include <learnix/idt.h>
+#include <learnix/irqstat.h>
+#include <learnix/ktime.h>
+#include <learnix/pit.h>
+#include <learnix/softirq.h>
+#include <learnix/timer.h>
+#include <learnix/x86/x86.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WHEEL_SLOTS (TVR_SIZE + TVN_LEVELS * TVN_SIZE)
+
+// slot of a timer that isn't pending
+#define TIMER_IDLE 0xFFFFFFFF
+
+// circular lists, the heads are never timers
+static timer_link_t wheel[WHEEL_SLOTS];
+
+// non-empty slots of the first level, for the tickless mode
+static uint32_t tv1_bitmap[TVR_SIZE / 32];
+
+// pending timers, and how many of them are in the coarser levels
+static uint32_t ntimers;
+static uint32_t nupper;
+
+// next tick the wheel has to process
+static uint32_t wheel_ticks;
+
+static clock_event_t *clock_event;
+static uint32_t timer_vector;
+static uint32_t cycles_per_tick;
+
+// nanoseconds per device cycle, << 16
+static uint32_t ns_per_cycle;
+static volatile uint64_t ticks;
+
+// one-shot mode: device cycles past the last whole tick, count
+// given to the device and the tick it fires at
+static uint32_t carry;
+static uint32_t programmed;
+static uint32_t deadline;
+
+static void
+wheel_insert(ktimer_t *timer)
+{
+	uint32_t delta = timer->expires - wheel_ticks;
+	uint32_t slot;
+
+	if ((int32_t)delta < 0)
+	{
+		// already due, it runs with the next tick
+		slot = wheel_ticks & (TVR_SIZE - 1);
+	}
+	else if (delta < TVR_SIZE)
+	{
+		slot = timer->expires & (TVR_SIZE - 1);
+	}
+	else
+	{
+		// level n holds the deltas below 2^(TVR_BITS + n * TVN_BITS)
+		uint32_t level = 1;
+		while (level < TVN_LEVELS
+		       && delta >= 1u << (TVR_BITS + level * TVN_BITS))
+			level++;
+		uint32_t shift = TVR_BITS + (level - 1) * TVN_BITS;
+		slot = TVR_SIZE + (level - 1) * TVN_SIZE
+		       + (timer->expires >> shift & (TVN_SIZE - 1));
+		nupper++;
+	}
+
+	// push at the tail, timers of a slot run in insertion order
+	timer_link_t *head = &wheel[slot];
+	timer->link.next = head;
+	timer->link.prev = head->prev;
+	head->prev->next = &timer->link;
+	head->prev = &timer->link;
+	timer->slot = slot;
+	if (slot < TVR_SIZE)
+		tv1_bitmap[slot / 32] |= 1u << (slot % 32);
+}
+
+static void
+wheel_remove(ktimer_t *timer)
+{
+	uint32_t slot = timer->slot;
+
+	timer->link.prev->next = timer->link.next;
+	timer->link.next->prev = timer->link.prev;
+	timer->slot = TIMER_IDLE;
+	if (slot >= TVR_SIZE)
+		nupper--;
+	else if (wheel[slot].next == &wheel[slot])
+		tv1_bitmap[slot / 32] &= ~(1u << (slot % 32));
+}
+
+// moves the timers of the current slot of a coarser level
+// to the levels below, returns the index of that slot
+static uint32_t
+cascade(uint32_t level)
+{
+	uint32_t index
+	    = wheel_ticks >> (TVR_BITS + (level - 1) * TVN_BITS) & (TVN_SIZE - 1);
+	timer_link_t *head = &wheel[TVR_SIZE + (level - 1) * TVN_SIZE + index];
+
+	while (head->next != head)
+	{
+		ktimer_t *timer = (ktimer_t *)head->next;
+		wheel_remove(timer);
+		wheel_insert(timer);
+	}
+	return index;
+}
+
+// runs the timers of every tick up to now, called with
+// interrupts disabled: they're enabled around the callbacks
+static void
+wheel_run(uint32_t now)
+{
+	while (!time_before(now, wheel_ticks))
+	{
+		uint32_t index = wheel_ticks & (TVR_SIZE - 1);
+
+		// the first level wrapped around
+		if (index == 0)
+		{
+			for (uint32_t level = 1;
+			     level <= TVN_LEVELS && cascade(level) == 0; level++)
+				;
+		}
+
+		// timers added by the callbacks go to the next slots
+		timer_link_t *head = &wheel[index];
+		wheel_ticks++;
+		while (head->next != head)
+		{
+			ktimer_t *timer = (ktimer_t *)head->next;
+			wheel_remove(timer);
+			ntimers--;
+			sti();
+			timer->fn(timer->ctx);
+			cli();
+		}
+	}
+}
+
+// returns how many ticks after wheel_ticks the wheel
+// has something to do, while some timer is pending
+static uint32_t
+wheel_next()
+{
+	uint32_t index = wheel_ticks & (TVR_SIZE - 1);
+
+	// first non-empty slot of the first level, in tick order
+	for (uint32_t off = 0; off < TVR_SIZE;)
+	{
+		uint32_t slot = (index + off) & (TVR_SIZE - 1);
+		uint32_t bits = tv1_bitmap[slot / 32] >> (slot % 32);
+		if (bits != 0)
+		{
+			off += __builtin_ctz(bits);
+			// a cascade may bring in an earlier timer
+			if (nupper > 0 && ((TVR_SIZE - index) & (TVR_SIZE - 1)) < off)
+				return (TVR_SIZE - index) & (TVR_SIZE - 1);
+			return off;
+		}
+		off += 32 - slot % 32;
+	}
+
+	// only coarser timers: wake up for the next cascade
+	return (TVR_SIZE - index) & (TVR_SIZE - 1);
+}
+
+static void
+timer_account(uint32_t elapsed)
+{
+	uint32_t total = carry + elapsed;
+
+	ticks += total / cycles_per_tick;
+	carry = total % cycles_per_tick;
+}
+
+// programs the clock event for the next deadline, or for
+// its longest count if no timer is pending
+static void
+timer_program()
+{
+	uint32_t delta = clock_event->max_delta / cycles_per_tick;
+
+	if (ntimers > 0)
+	{
+		int32_t next = wheel_ticks + wheel_next() - (uint32_t)ticks;
+		if (next < 1)
+			next = 1;
+		if ((uint32_t)next < delta)
+			delta = next;
+	}
+
+	// carry < cycles_per_tick, so the count is never 0
+	programmed = delta * cycles_per_tick - carry;
+	deadline = (uint32_t)ticks + delta;
+	clock_event->set_oneshot(programmed);
+}
+
+static void
+timer_interrupt(trapframe_t *tf, void *ctx)
+{
+	(void)tf;
+	(void)ctx;
+
+	// with the cycles past the deadline the interrupt
+	// latency doesn't add up over the one-shots
+	if (TIMER_ONESHOT)
+	{
+		uint32_t elapsed = clock_event->elapsed();
+		if (irqstat_enabled && elapsed > programmed)
+			irqstat_latency((uint64_t)(elapsed - programmed) * ns_per_cycle
+			                >> 16);
+		timer_account(elapsed);
+		// keeps the device armed if the softirq is held back,
+		// the wheel being late it fires in a tick at most
+		timer_program();
+	}
+	else
+		ticks++;
+
+	raise_softirq(TIMER_SOFTIRQ);
+}
+
+// bottom half of the timer interrupt, runs the expired timers
+static void
+timer_softirq()
+{
+	uint64_t tsc = irqstat_enabled ? read_tsc() : 0;
+
+	cli();
+	wheel_run((uint32_t)ticks);
+	if (TIMER_ONESHOT)
+		timer_program();
+	sti();
+
+	if (irqstat_enabled)
+		irqstat_soft(timer_vector, read_tsc() - tsc);
+}
+
+void
+timer_init()
+{
+	uint32_t vector;
+
+	for (uint32_t slot = 0; slot < WHEEL_SLOTS; slot++)
+		wheel[slot].next = wheel[slot].prev = &wheel[slot];
+
+	// the LAPIC timer is per CPU and costs no port I/O
+	if (lapic != NULL && lapic_timer_calibrate() == 0)
+	{
+		clock_event = &lapic_clock_event;
+		vector = LAPIC_TIMER_IDX;
+	}
+	else
+	{
+		clock_event = &pit_clock_event;
+		vector = IRQ0_IDX;
+	}
+	cycles_per_tick = (clock_event->freq + TIMER_HZ / 2) / TIMER_HZ;
+	ns_per_cycle = (NSEC_PER_SEC << 16) / clock_event->freq;
+	timer_vector = vector;
+	open_softirq(TIMER_SOFTIRQ, timer_softirq);
+	register_irq_handler(vector, timer_interrupt, NULL);
+
+	uint32_t eflags = read_eflags();
+	cli();
+	if (TIMER_ONESHOT)
+		timer_program();
+	else
+		clock_event->set_periodic(cycles_per_tick);
+
+	// enable IRQ0 (PIT line), through the I/O APIC it must
+	// arrive on the vector timer_interrupt() is registered on
+	if (clock_event == &pit_clock_event)
+	{
+		if (lapic != NULL && ioapic_irq_vector(0) != IRQ0_IDX)
+			panic("timer: IRQ0 isn't routed to its vector");
+		irq_unmask(0);
+	}
+	write_eflags(eflags);
+
+	serial_printf("[LOG] timer: %s, %d Hz counter, %d cycles per tick%s\n",
+	              clock_event->name, clock_event->freq, cycles_per_tick,
+	              TIMER_ONESHOT ? ", one-shot" : "");
+
+	// TEST
+	test_timer();
+}
+
+uint64_t
+timer_ticks()
+{
+	uint32_t eflags = read_eflags();
+	cli();
+	uint64_t now = ticks;
+	// in one-shot mode ticks only moves at the interrupts
+	if (TIMER_ONESHOT && clock_event != NULL)
+		now += (carry + clock_event->elapsed()) / cycles_per_tick;
+	write_eflags(eflags);
+	return now;
+}
+
+void
+timer_setup(ktimer_t *timer, void (*fn)(void *ctx), void *ctx)
+{
+	timer->link.next = timer->link.prev = NULL;
+	timer->slot = TIMER_IDLE;
+	timer->fn = fn;
+	timer->ctx = ctx;
+}
+
+void
+timer_add(ktimer_t *timer, uint32_t expires)
+{
+	uint32_t eflags = read_eflags();
+	cli();
+	if (timer->slot != TIMER_IDLE)
+		wheel_remove(timer);
+	else
+		ntimers++;
+	timer->expires = expires;
+	wheel_insert(timer);
+
+	// the device may be programmed past the new deadline, unless
+	// it fired already and the interrupt is about to reprogram it
+	if (TIMER_ONESHOT && clock_event != NULL
+	    && time_before(expires, deadline))
+	{
+		uint32_t elapsed = clock_event->elapsed();
+		if (elapsed < programmed)
+		{
+			timer_account(elapsed);
+			timer_program();
+		}
+	}
+	write_eflags(eflags);
+}
+
+int
+timer_del(ktimer_t *timer)
+{
+	int pending = 0;
+
+	uint32_t eflags = read_eflags();
+	cli();
+	if (timer->slot != TIMER_IDLE)
+	{
+		wheel_remove(timer);
+		ntimers--;
+		pending = 1;
+	}
+	write_eflags(eflags);
+	return pending;
+}
+
+static ktimer_t test_timers[4];
+static uint32_t test_fired;
+
+static void
+test_timer_fn(void *ctx)
+{
+	ktimer_t *timer = ctx;
+
+	if (time_before((uint32_t)timer_ticks(), timer->expires))
+		panic("TIMER TEST #1");
+	if (timer == &test_timers[3])
+		panic("TIMER TEST #2");
+	if (++test_fired == 3)
+		printf("[ OK ] TIMER TEST PASSED!\n");
+}
+
+// the timers run later, from the timer interrupt
+void
+test_timer()
+{
+	uint32_t now = timer_ticks();
+	uint32_t delays[4] = { 1, 10, 300, 20 };
+
+	// 300 ticks sit in the second level until a cascade
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		timer_setup(&test_timers[i], test_timer_fn, &test_timers[i]);
+		timer_add(&test_timers[i], now + delays[i]);
+	}
+	if (timer_del(&test_timers[3]) != 1 || timer_del(&test_timers[3]) != 0)
+		panic("TIMER TEST #3");
+}
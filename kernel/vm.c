@@ -1,4 +1,10 @@
 #include "learnix/kheap.h"
+#include <learnix/arena.h>
+#include <learnix/cpu.h>
+#include <learnix/fpu.h>
+#include <learnix/simd.h>
+#include <learnix/slab.h>
+#include <learnix/vmalloc.h>
 #include <learnix/drivers/serial.h>
 #include <learnix/vm.h>
 #include <learnix/x86/mmu.h>
@@ -6,6 +12,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // points to the first byte after kernel code
 extern char _kernel_end[];
@@ -13,45 +20,150 @@ extern char _kernel_end[];
 // symbol defined in boot/boot.S which points to the kernel's page directory
 extern char boot_page_directory[];
 
-// total number of physical pages
+// number of entries of pages[]: highest usable page frame number + 1
 uint32_t npages;
 
 // physical page metadata array of size npages *
-// sizeof(physical_page_metadata_t)
+// sizeof(physical_page_metadata_t), indexed by page frame number
 physical_page_metadata_t *pages;
 
-// points to the next free physical page to service allocation requests
-physical_page_metadata_t *pages_free_list;
+// usable RAM regions from the multiboot memory map, sorted
+// by address and never overlapping
+mem_region_t mem_regions[MAX_MEM_REGIONS];
+uint32_t nmem_regions;
+
+// [boot_alloc_start, boot_alloc_next) are the physical bytes handed
+// out by boot_alloc() while pages[] is being built, boot_alloc_done
+// is set once the rest of the bump region went to the page allocator
+static physaddr_t boot_alloc_start, boot_alloc_next;
+static int boot_alloc_done;
+
+// set once pages[] is initialized and page_alloc() can be used
+static int pages_ready;
+
+// pages[] is mapped and initialized one chunk at a time, chunks
+// from pages_deferred_chunk on are still waiting to be initialized
+static uint32_t pages_nchunks, pages_deferred_chunk;
+
+// cycles spent by pages_deferred_init() outside of boot
+static uint64_t pages_deferred_cycles;
+
+// set if CR4.PSE is enabled and map_large() can be used
+static int pse_enabled;
+
+// PTE_G once CR4.PGE is enabled: kernel half mappings are the
+// same in every address space and can survive CR3 reloads
+static uint32_t pte_global;
+
+// flushes the whole TLB, global entries included:
+// picked by pge_setup() for the CPU
+static void (*tlbflush_global)(void) = tlbflush;
+
+// frames already cleared by zero_pool_refill(), zero_pool[0] to
+// zero_pool[zero_pool_avail - 1] are ready to become page tables
+static physical_page_metadata_t *zero_pool[ZERO_POOL_SIZE];
+static uint32_t zero_pool_avail, zero_pool_hits, zero_pool_misses;
+
+// end of the RAM and of the ACPI tables, in bytes
+static uint64_t physmap_top;
+
+// set once physmap_setup() mapped the low physical memory
+static int physmap_ready;
+
+// page fault counters, see vm_page_fault()
+static vm_fault_stats_t vm_faults;
+
+// page table of the kmap() window and its slots in use
+static pte_t *kmap_ptes;
+static uint32_t kmap_used[KMAP_SLOTS / 32];
+
+// buddy allocator free lists: free_lists[zone][order] points to the
+// first free block of 2^order physical pages of the given zone
+physical_page_metadata_t *free_lists[NR_ZONES][BUDDY_MAX_ORDER + 1];
+
+// number of free physical pages across all the free lists
+uint32_t nfree_pages;
 
 // kernel page directory's virtual address
 pde_t* kern_pgdir;
 
+static void pages_free_range(uint32_t start, uint32_t end);
+static physical_page_metadata_t *buddy_alloc(uint32_t zone, uint32_t order);
+static inline pte_t *pgtable_kva(pde_t *pgdir, uint32_t pdx);
+static void pse_setup();
+static void pge_setup();
+static void physmap_setup();
+static void mem_regions_setup(multiboot_info_t *mbi);
+
 void
 test_vm_system()
 {
-	// TEST #1 -> map_va() that triggers pgdir_wa() -> page_alloc()
+	// TEST #1 -> map_va() that triggers pgdir_wa() -> zero_pool_get()
 	// because no page table entry is currently allocated for va
-	physical_page_metadata_t *page_dir_phys_page = pages_free_list;
-	map_va(kern_pgdir, 0xC0400000, 0x00300000);
-	if (pages_free_list == page_dir_phys_page)
+	zero_pool_stats_t zstats;
+	zero_pool_stats(&zstats);
+	uint32_t free_before = page_free_count() + zstats.avail;
+	uint32_t hits_before = zstats.hits;
+	map_va(kern_pgdir, VMALLOC_BASE, 0x00300000);
+	zero_pool_stats(&zstats);
+	if (page_free_count() + zstats.avail != free_before - 1
+	    || zstats.hits != hits_before + 1)
 		panic("VM TEST #1");
-	serial_printf("0xC0400000 -> %x\n", va_to_pa(kern_pgdir, 0xC0400000));
+	serial_printf("%x -> %x\n", VMALLOC_BASE,
+	              va_to_pa(kern_pgdir, VMALLOC_BASE));
 	dbg_dump_pgdir(kern_pgdir, "kernel");
 
 	// TEST #2 -> unmap_va() that page_free() the page directory
 	// erased
 	serial_printf("TEST #2: unmap_va()");
-	unmap_va(kern_pgdir, 0xC0400000);
-	if (pages_free_list != page_dir_phys_page)
+	unmap_va(kern_pgdir, VMALLOC_BASE);
+	zero_pool_stats(&zstats);
+	if (page_free_count() + zstats.avail != free_before)
 		panic("VM TEST #2");
 	dbg_dump_pgdir(kern_pgdir, "kernel");
-	serial_printf("pages_free_list: %x\n", page2pa(pages_free_list));
+	free_before = page_free_count();
+
+	// TEST #3 -> page_alloc_order() returns a naturally aligned
+	// block and page_free_order() merges it back with its buddies
+	physical_page_metadata_t *block = page_alloc_order(3);
+	if (block == NULL || ((block - pages) & 7) != 0
+	    || page_free_count() != free_before - 8)
+		panic("VM TEST #3");
+	page_free_order(block, 3);
+	if (page_free_count() != free_before)
+		panic("VM TEST #3");
+	serial_printf("nfree_pages: %d\n", page_free_count());
+
+	// TEST #4 -> vmalloc() only reserves virtual memory: touching
+	// two pages faults in two frames plus a page table, vfree()
+	// gives all of them back
+	vm_fault_stats_t fstats;
+	vm_fault_stats(&fstats);
+	uint32_t faults_before = fstats.vmalloc;
+	zero_pool_stats(&zstats);
+	free_before = page_free_count() + zstats.avail;
+	volatile char *buf = vmalloc(0x100000);
+	if (buf == NULL)
+		panic("VM TEST #4");
+	buf[0] = 1;
+	buf[100 * PGSIZE] = 1;
+	vm_fault_stats(&fstats);
+	zero_pool_stats(&zstats);
+	if (fstats.vmalloc != faults_before + 2
+	    || page_free_count() + zstats.avail != free_before - 3)
+		panic("VM TEST #4");
+	vfree((void *)buf);
+	zero_pool_stats(&zstats);
+	if (page_free_count() + zstats.avail != free_before)
+		panic("VM TEST #4");
+	serial_printf("page faults: %d, %d cycles max\n", fstats.vmalloc,
+	              fstats.max_cycles);
 
 	printf("[ OK ] VM TEST PASSED!\n");
 }
 
 void
-vm_setup(uint32_t memlower, uint32_t memupper)
+vm_setup(multiboot_info_t *mbi)
 {
 	// setup the kern_pgdir
 	kern_pgdir = (pte_t *)boot_page_directory;
@@ -62,98 +174,670 @@ vm_setup(uint32_t memlower, uint32_t memupper)
 	// all the page tables
 	kern_pgdir[1023] = rcr3() | PTE_P | PTE_W;
 
-	// compute upper memory total of physical pages
-	npages = (memupper * 1024) / PGSIZE;
+	// enable 4 MB and global pages if the CPU supports them
+	pse_setup();
+	pge_setup();
+
+	// collect the usable RAM regions reported by the bootloader
+	mem_regions_setup(mbi);
 
-	serial_printf("[LOG] memupper: %d KB for a total of %d pages\n",
-	              memupper, npages);
+	// boot_alloc() starts right after the kernel image
+	boot_alloc_start = kva2pa((uintptr_t)_kernel_end);
+	boot_alloc_next = boot_alloc_start;
+
+	// map the low physical memory at KERN_BASE_VRT,
+	// this replaces whatever boot.S mapped there
+	physmap_setup();
+
+	// pages[] has one entry for each page frame up to the
+	// end of the last usable region
+	npages = mem_regions[nmem_regions - 1].end_pfn;
+
+	serial_printf("[LOG] %d usable regions, highest pfn: %x\n",
+	              nmem_regions, npages);
 
 	// initialize the physical page tracking structure
 	pages_setup();
 
+	// the kmap() window keeps its page table forever
+	kmap_ptes = pgdir_walk(kern_pgdir, KMAP_BASE, 1);
+
+	// fill the pool of zeroed frames for page tables
+	zero_pool_refill();
+
 	// TEST
 	test_vm_system();
 	
 	// initialize the kernel heap
-	// at the first virtual page after
-	// the end of kernel's code
-	kheap_init((uintptr_t)_kernel_end);
+	// in its own virtual window
+	kheap_init(KHEAP_BASE);
+
+	// object caches carve frames from the page allocator
+	kmem_cache_init();
+
+	// TEST
+	test_arena();
 }
 
-// @todo also allocate low-mem pages after parsing multiboot struct
-void
-pages_setup()
+// enables CR4.PSE when CPUID reports page size extension support
+static void
+pse_setup()
 {
-	uint32_t i, va, pa;
+	if (!cpu_has(CPU_FEATURE_PSE))
+	{
+		serial_printf("[LOG] PSE not supported, using 4 KB pages\n");
+		return;
+	}
 
-	// allocate space for pages[] starting from 1MB physical
-	pages = (physical_page_metadata_t *)pa2kva(EXT_MEM_BASE);
+	lcr4(rcr4() | CR4_PSE);
+	pse_enabled = 1;
+}
 
-	// how many pages are needed to contain the pages[] array... must
-	// virtually map those to avoid faults
-	uint32_t pages_to_map
-	    = ((npages * sizeof(physical_page_metadata_t)) / PGSIZE) + 1;
+// enables CR4.PGE when CPUID reports global pages support
+static void
+pge_setup()
+{
+	if (!cpu_has(CPU_FEATURE_PGE))
+	{
+		serial_printf("[LOG] PGE not supported, no global pages\n");
+		return;
+	}
 
-	serial_printf("[LOG] mapping pages[]\n");
-	// and map those starting from 1MB physical
-	for (i = 0, va = (uintptr_t)pages, pa = EXT_MEM_BASE; i < pages_to_map;
-	     i++, va += PGSIZE, pa += PGSIZE)
+	lcr4(rcr4() | CR4_PGE);
+	pte_global = PTE_G;
+
+	// a CR3 reload keeps the global entries: invpcid drops them
+	// in one instruction, toggling CR4.PGE takes two CR4 writes
+	if (cpu_has(CPU_FEATURE_INVPCID))
+		tlbflush_global = invpcid_flush_all;
+	else
+		tlbflush_global = tlbflush_all;
+}
+
+// maps [0, physmap_top) at KERN_BASE_VRT, up to PHYSMAP_LIMIT,
+// with large pages when available: from then on every low memory
+// frame, page tables included, is reachable through pa2kva()
+static void
+physmap_setup()
+{
+	uint64_t end = LGPGROUNDUP(physmap_top);
+
+	if (end > PHYSMAP_LIMIT)
+		end = PHYSMAP_LIMIT;
+
+	for (uint64_t pa = 0; pa < end; pa += LGPGSIZE)
 	{
-		map_va(kern_pgdir, va, pa);
+		uintptr_t va = (uintptr_t)pa2kva(pa);
+
+		// the first one replaces boot_page_table1, which
+		// lives in .bss so there is nothing to free
+		if (map_large(kern_pgdir, va, pa) == 0)
+			continue;
+		map_range(kern_pgdir, va, pa, NPTENTRIES, PTE_W);
 	}
-	serial_printf("[LOG] finished mapping pages[]\n");
+	physmap_ready = 1;
+
+	serial_printf("[LOG] physmap: %x - %x\n", KERN_BASE_VRT,
+	              KERN_BASE_VRT + (uint32_t)end);
+}
+
+// inserts [start_pfn, end_pfn) in the sorted mem_regions[] array,
+// merging it with the regions it overlaps or touches
+static void
+mem_region_add(uint32_t start_pfn, uint32_t end_pfn)
+{
+	uint32_t i, j;
 
-	// 1MB - pages_to_map is occupied by pages[]
-	for (i = page_num(EXT_MEM_BASE); i < pages_to_map; i++)
+	// find the first region that ends at or after start_pfn
+	for (i = 0; i < nmem_regions; i++)
 	{
-		pages[i].ref_count = 0;
-		pages[i].flags = PPM_KERN;
-		pages[i].next = NULL;
+		if (mem_regions[i].end_pfn >= start_pfn)
+			break;
 	}
 
-	// pages_to_map - 2MB is free
-	for (i = pages_to_map; i < page_num(KERN_BASE_PHYS); i++)
+	// merge every region that overlaps the new one
+	while (i < nmem_regions && mem_regions[i].start_pfn <= end_pfn)
 	{
-		pages[i].ref_count = 0;
-		pages[i].flags = 0;
-		pages[i].next = pages_free_list;
-		pages_free_list = &pages[i];
+		if (mem_regions[i].start_pfn < start_pfn)
+			start_pfn = mem_regions[i].start_pfn;
+		if (mem_regions[i].end_pfn > end_pfn)
+			end_pfn = mem_regions[i].end_pfn;
+		for (j = i; j + 1 < nmem_regions; j++)
+			mem_regions[j] = mem_regions[j + 1];
+		nmem_regions--;
+	}
+
+	if (nmem_regions == MAX_MEM_REGIONS)
+	{
+		serial_printf("[LOG] too many memory regions, dropping %x\n",
+		              start_pfn << PTXSHIFT);
+		return;
+	}
+
+	// shift the following regions to make room for the new one
+	for (j = nmem_regions; j > i; j--)
+		mem_regions[j] = mem_regions[j - 1];
+	mem_regions[i].start_pfn = start_pfn;
+	mem_regions[i].end_pfn = end_pfn;
+	nmem_regions++;
+}
+
+// walks the multiboot memory map and fills mem_regions[]
+// with the page aligned usable RAM below 4 GB
+static void
+mem_regions_setup(multiboot_info_t *mbi)
+{
+	uintptr_t mmap = (uintptr_t)pa2kva(mbi->mmap_addr);
+	uintptr_t mmap_end = mmap + mbi->mmap_length;
+
+	// the memory map must be reachable through the boot page table
+	if (mbi->mmap_addr + mbi->mmap_length > NPTENTRIES * PGSIZE)
+		panic("[GRUB] memory map out of the boot mapping");
+	for (uintptr_t va = PGROUNDDOWN(mmap); va < mmap_end; va += PGSIZE)
+	{
+		if (!va_to_pa(kern_pgdir, va))
+			map_va(kern_pgdir, va, kva2pa(va));
+	}
+
+	multiboot_memory_map_t *entry = (multiboot_memory_map_t *)mmap;
+	while ((uintptr_t)entry < mmap_end)
+	{
+		uint64_t start = entry->addr;
+		uint64_t end = entry->addr + entry->len;
+
+		serial_printf("[LOG] mmap: %x - %x type %d\n", (uint32_t)start,
+		              (uint32_t)end, entry->type);
+
+		// without PAE frames above 4 GB can't be mapped
+		if (end > PHYS_MEM_LIMIT)
+			end = PHYS_MEM_LIMIT;
+
+		// the physmap also covers the ACPI tables
+		if ((entry->type == MULTIBOOT_MEMORY_AVAILABLE
+		     || entry->type == MULTIBOOT_MEMORY_ACPI_RECLAIMABLE
+		     || entry->type == MULTIBOOT_MEMORY_NVS)
+		    && end > physmap_top)
+			physmap_top = end;
+
+		// only keep the pages that are completely usable
+		if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && start < end)
+		{
+			uint32_t start_pfn = (start + PGSIZE - 1) >> PTXSHIFT;
+			uint32_t end_pfn = end >> PTXSHIFT;
+			if (start_pfn < end_pfn)
+				mem_region_add(start_pfn, end_pfn);
+		}
+
+		// the size field doesn't count itself
+		entry = (multiboot_memory_map_t *)((uintptr_t)entry + entry->size
+		                                   + sizeof(entry->size));
+	}
+
+	if (nmem_regions == 0)
+		panic("[GRUB] no usable memory");
+}
+
+void *
+boot_alloc(uint32_t size, uint32_t align)
+{
+	if (boot_alloc_done)
+		panic("boot_alloc: the page allocator is already running");
+	if (align == 0)
+		align = sizeof(void *);
+
+	// bump the pointer past the alignment padding,
+	// skipping the holes between the usable regions
+	for (uint32_t i = 0; i < nmem_regions; i++)
+	{
+		uint64_t start = (uint64_t)mem_regions[i].start_pfn << PTXSHIFT;
+		uint64_t end = (uint64_t)mem_regions[i].end_pfn << PTXSHIFT;
+		uint64_t pa = boot_alloc_next > start ? boot_alloc_next : start;
+
+		pa = (pa + align - 1) & ~((uint64_t)align - 1);
+		if (pa + size > end)
+			continue;
+		boot_alloc_next = pa + size;
+		return pa2kva(pa);
+	}
+	panic("boot_alloc: out of physical memory");
+	return NULL;
+}
+
+// hands out n contiguous frames to back pages[] and its
+// page tables before the buddy allocator exists
+static physaddr_t
+early_frames_alloc(uint32_t n)
+{
+	return kva2pa((uintptr_t)boot_alloc(n * PGSIZE, PGSIZE));
+}
+
+static physaddr_t
+early_frame_alloc()
+{
+	return early_frames_alloc(1);
+}
+
+// returns the physical address of n contiguous frames to back pages[]
+static physaddr_t
+pages_frames_alloc(uint32_t n)
+{
+	uint32_t order = 0;
+
+	if (!pages_ready)
+		return early_frames_alloc(n);
+
+	while ((1u << order) < n)
+		order++;
+	physical_page_metadata_t *pp = page_alloc_order(order);
+	if (pp == NULL)
+		panic("pages_frames_alloc: out of physical pages");
+
+	// give back the tail of the block that isn't needed
+	for (uint32_t i = n; i < (1u << order); i++)
+		page_free(pp + i);
+	return page2pa(pp);
+}
+
+// returns 1 if some usable frame is in [first, last]
+static int
+pfns_usable(uint32_t first, uint32_t last)
+{
+	for (uint32_t i = 0; i < nmem_regions; i++)
+	{
+		if (mem_regions[i].start_pfn <= last
+		    && mem_regions[i].end_pfn > first)
+			return 1;
 	}
+	return 0;
+}
 
-	// 2MB - endkernel is occupied by kernel code
-	for (i = page_num(KERN_BASE_PHYS); i < page_num(kva2pa((uintptr_t)_kernel_end));
-	     i++)
+// marks pages[start, end) as allocated forever
+static void
+pages_reserve_range(uint32_t start, uint32_t end)
+{
+	for (uint32_t i = start; i < end; i++)
 	{
 		pages[i].ref_count = 0;
 		pages[i].flags = PPM_KERN;
+		pages[i].order = 0;
 		pages[i].next = NULL;
+		pages[i].prev = NULL;
 	}
+}
 
-	// the rest is free
-	for (i; i < npages; i++)
+// hands the usable region [start, end) to the buddy allocator
+// except for the frames that are already in use
+static void
+pages_init_region(uint32_t start, uint32_t end)
+{
+	// frames in use at this point: the real mode IVT/BDA page, the
+	// kernel image and what boot_alloc() handed out
+	uint32_t reserved[3][2] = {
+		{ 0, 1 },
+		{ KERN_BASE_PHYS >> PTXSHIFT,
+		  PGROUNDUP(kva2pa((uintptr_t)_kernel_end)) >> PTXSHIFT },
+		{ boot_alloc_start >> PTXSHIFT,
+		  PGROUNDUP(boot_alloc_next) >> PTXSHIFT },
+	};
+	uint32_t pfn = start;
+
+	while (pfn < end)
 	{
-		pages[i].ref_count = 0;
-		pages[i].flags = 0;
-		pages[i].next = pages_free_list;
-		pages_free_list = &pages[i];
+		// find the lowest reserved range overlapping [pfn, end)
+		uint32_t rs = end, re = end;
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			if (reserved[k][1] > pfn && reserved[k][0] < rs)
+			{
+				rs = reserved[k][0] > pfn ? reserved[k][0] : pfn;
+				re = reserved[k][1] < end ? reserved[k][1] : end;
+			}
+		}
+
+		pages_free_range(pfn, rs);
+		pages_reserve_range(rs, re);
+		pfn = re;
+	}
+}
+
+// backs the 4 MB of pages[] starting at va with a single large page
+// when va begins a page directory entry that pages[] fills completely,
+// returns 0 if the caller has to fall back to 4 KB pages
+static int
+pages_map_large(uintptr_t va)
+{
+	uintptr_t pages_end = (uintptr_t)&pages[pages_nchunks * PAGES_CHUNK_PFNS];
+
+	// before pages[] is ready there's no way to get 4 MB aligned frames
+	if (!pages_ready || !pse_enabled || LGPGOFFSET(va) != 0
+	    || va + LGPGSIZE > pages_end || (kern_pgdir[PDX(va)] & PTE_P))
+		return 0;
+
+	physical_page_metadata_t *pp = page_alloc_order(BUDDY_MAX_ORDER);
+	if (pp == NULL)
+		return 0;
+
+	map_large(kern_pgdir, va, page2pa(pp));
+	memset((void *)va, 0, LGPGSIZE);
+	return 1;
+}
+
+// backs the pages[] entries of the given chunk with fresh frames,
+// returns 0 if the chunk has no usable frames and is left unmapped
+static int
+pages_chunk_map(uint32_t chunk)
+{
+	uint32_t start = chunk * PAGES_CHUNK_PFNS;
+	uintptr_t va = (uintptr_t)&pages[start];
+
+	if (!pfns_usable(start, start + PAGES_CHUNK_PFNS - 1))
+		return 0;
+
+	for (uint32_t off = 0, n; off < PAGES_CHUNK_SIZE; off += n * PGSIZE)
+	{
+		n = 1;
+
+		// already backed by a large page
+		if (kern_pgdir[PDX(va + off)] & PTE_PS)
+			continue;
+		if (pages_map_large(va + off))
+			continue;
+
+		// map the rest of the chunk in one go, stopping at the
+		// next 4 MB boundary which may get a large page instead
+		while (off + n * PGSIZE < PAGES_CHUNK_SIZE
+		       && LGPGOFFSET(va + off + n * PGSIZE) != 0)
+			n++;
+		map_range(kern_pgdir, va + off, pages_frames_alloc(n), n, PTE_W);
+		memset((void *)(va + off), 0, n * PGSIZE);
+	}
+	return 1;
+}
+
+// initializes the pages[] entries of an already mapped chunk
+// and hands its free frames to the buddy allocator
+static void
+pages_chunk_init(uint32_t chunk)
+{
+	uint32_t start = chunk * PAGES_CHUNK_PFNS;
+	uint32_t end = start + PAGES_CHUNK_PFNS;
+
+	for (uint32_t i = 0; i < nmem_regions; i++)
+	{
+		uint32_t s = mem_regions[i].start_pfn > start
+		                 ? mem_regions[i].start_pfn
+		                 : start;
+		uint32_t e = mem_regions[i].end_pfn < end ? mem_regions[i].end_pfn
+		                                          : end;
+		if (s < e)
+			pages_init_region(s, e);
+	}
+}
+
+// sets the present count of the page tables that were
+// installed while pages[] didn't exist yet
+static void
+pgtables_count()
+{
+	// the last entry is the recursive mapping
+	for (uint32_t pdx = 0; pdx < NPDENTRIES - 1; pdx++)
+	{
+		pde_t pde = kern_pgdir[pdx];
+		if (!(pde & PTE_P) || (pde & PTE_PS))
+			continue;
+
+		pte_t *pgtable = pgtable_kva(kern_pgdir, pdx);
+		uint16_t present = 0;
+		for (uint32_t ptx = 0; ptx < NPTENTRIES; ptx++)
+		{
+			if (pgtable[ptx] & PTE_P)
+				present++;
+		}
+		pa2pp(PTE_ADDR(pde))->ref_count = present;
+	}
+}
+
+void
+pages_setup()
+{
+	uint64_t tsc = read_tsc();
+	uint32_t chunk, eager;
+
+	// pages[] lives in its own virtual window and is indexed by page
+	// frame number, so page2pa() and pa2pp() are a single shift away
+	pages = (physical_page_metadata_t *)PAGES_VBASE;
+	pages_nchunks = (npages + PAGES_CHUNK_PFNS - 1) / PAGES_CHUNK_PFNS;
+	if (pages_nchunks * PAGES_CHUNK_SIZE > PAGES_VSIZE)
+		panic("pages_setup: pages[] doesn't fit its window");
+
+	// only the first PAGES_EAGER_PFNS frames are described right away,
+	// the other chunks are initialized later by pages_deferred_init()
+	eager = PAGES_EAGER_PFNS / PAGES_CHUNK_PFNS;
+	if (eager > pages_nchunks)
+		eager = pages_nchunks;
+
+	serial_printf("[LOG] mapping pages[]\n");
+	// every early allocation must happen before the first chunk is
+	// initialized, otherwise the frames could be handed out twice
+	for (chunk = 0; chunk < eager; chunk++)
+		pages_chunk_map(chunk);
+	serial_printf("[LOG] finished mapping pages[]\n");
+
+	// hand over the bump region: the frames that boot_alloc()
+	// didn't use are freed with the rest of their chunk
+	boot_alloc_done = 1;
+	serial_printf("[LOG] boot_alloc: %d bytes used\n",
+	              boot_alloc_next - boot_alloc_start);
+
+	// from now on page tables come from the buddy allocator
+	for (chunk = 0; chunk < eager; chunk++)
+		pages_chunk_init(chunk);
+	pgtables_count();
+	pages_ready = 1;
+	pages_deferred_chunk = eager;
+
+	serial_printf("[LOG] pages_setup: %d cycles, %d free pages, %d chunks "
+	              "deferred\n",
+	              (uint32_t)(read_tsc() - tsc), nfree_pages,
+	              pages_nchunks - eager);
+}
+
+uint32_t
+pages_deferred_init(uint32_t nchunks)
+{
+	// page_alloc() calls back here while a chunk is being mapped
+	static int busy;
+	uint32_t advanced = 0;
+
+	// page_alloc() could be called by an interrupt handler,
+	// so busy is tested and set with interrupts disabled
+	uint32_t eflags = read_eflags();
+	cli();
+	if (busy || pages_deferred_chunk >= pages_nchunks)
+	{
+		write_eflags(eflags);
+		return 0;
+	}
+	busy = 1;
+
+	// chunks that are holes in the memory map count as
+	// advanced too, so that 0 is only returned when done
+	uint64_t tsc = read_tsc();
+	while (advanced < nchunks && pages_deferred_chunk < pages_nchunks)
+	{
+		if (pages_chunk_map(pages_deferred_chunk))
+			pages_chunk_init(pages_deferred_chunk);
+		pages_deferred_chunk++;
+		advanced++;
+	}
+	pages_deferred_cycles += read_tsc() - tsc;
+
+	if (pages_deferred_chunk == pages_nchunks)
+		serial_printf("[LOG] deferred pages[] init done: %d cycles "
+		              "saved at boot, %d free pages\n",
+		              (uint32_t)pages_deferred_cycles, nfree_pages);
+
+	busy = 0;
+	write_eflags(eflags);
+	return advanced;
+}
+
+// clears pp through the physmap
+static inline void
+zero_frame(physical_page_metadata_t *pp)
+{
+	memset(pp2kva(pp), 0, PGSIZE);
+}
+
+// clears pp for the pool: the frame may wait long before being
+// used, non-temporal stores keep it out of the caches
+static inline void
+zero_frame_nt(physical_page_metadata_t *pp)
+{
+	if (!fpu_ready)
+	{
+		zero_frame(pp);
+		return;
+	}
+	kernel_fpu_begin();
+	simd_clear_page(pp2kva(pp));
+	kernel_fpu_end();
+}
+
+uint32_t
+zero_pool_refill()
+{
+	uint32_t added = 0, eflags = read_eflags();
+
+	while (zero_pool_avail < ZERO_POOL_SIZE)
+	{
+		// the pool is also used from the page fault handler,
+		// interrupts are only kept off while a single frame
+		// is being cleared
+		cli();
+		physical_page_metadata_t *pp = page_alloc_order(0);
+		if (pp != NULL)
+		{
+			zero_frame_nt(pp);
+			zero_pool[zero_pool_avail++] = pp;
+			added++;
+		}
+		write_eflags(eflags);
+
+		if (pp == NULL)
+			break;
 	}
+	return added;
 }
 
 physical_page_metadata_t *
-page_alloc()
+zero_pool_get()
 {
-	// fetch the next free page from the linked list
-	physical_page_metadata_t *pp = pages_free_list;
+	if (zero_pool_avail == 0)
+	{
+		zero_pool_misses++;
+		return NULL;
+	}
+	zero_pool_hits++;
+	return zero_pool[--zero_pool_avail];
+}
 
-	// panic if out-of-pages
+physical_page_metadata_t *
+page_alloc_zeroed()
+{
+	physical_page_metadata_t *pp = zero_pool_get();
+
+	// pool miss: pay for the zeroing right now
 	if (pp == NULL)
-		panic("page_alloc: out of physical pages");
+	{
+		pp = page_alloc();
+		zero_frame(pp);
+	}
+	return pp;
+}
 
-	// update the free_page_list
-	pages_free_list = pp->next;
+void
+zero_pool_stats(zero_pool_stats_t *stats)
+{
+	stats->hits = zero_pool_hits;
+	stats->misses = zero_pool_misses;
+	stats->avail = zero_pool_avail;
+}
 
-	// clear pp->next
+// removes the free block pp from the free list of the given order
+static inline void
+free_list_remove(physical_page_metadata_t *pp, uint32_t order)
+{
+	if (pp->prev != NULL)
+		pp->prev->next = pp->next;
+	else
+		free_lists[page_zone(pp)][order] = pp->next;
+	if (pp->next != NULL)
+		pp->next->prev = pp->prev;
 	pp->next = NULL;
+	pp->prev = NULL;
+	pp->flags &= ~PPM_FREE;
+}
+
+// pushes the block pp on the free list of the given order
+static inline void
+free_list_push(physical_page_metadata_t *pp, uint32_t order)
+{
+	pp->order = order;
+	pp->flags |= PPM_FREE;
+	pp->prev = NULL;
+	pp->next = free_lists[page_zone(pp)][order];
+	if (pp->next != NULL)
+		pp->next->prev = pp;
+	free_lists[page_zone(pp)][order] = pp;
+}
+
+// hands the pages[start, end) range to the buddy allocator
+// using the largest naturally aligned blocks that fit
+static void
+pages_free_range(uint32_t start, uint32_t end)
+{
+	uint32_t i, order;
+
+	for (i = start; i < end; i += (1 << order))
+	{
+		// grow the block while it stays aligned and inside the range
+		order = 0;
+		while (order < BUDDY_MAX_ORDER && (i & (1 << order)) == 0
+		       && i + (2 << order) <= end)
+			order++;
+
+		for (uint32_t j = i; j < i + (1 << order); j++)
+		{
+			pages[j].ref_count = 0;
+			pages[j].flags = 0;
+			pages[j].order = 0;
+			pages[j].next = NULL;
+			pages[j].prev = NULL;
+		}
+		page_free_order(&pages[i], order);
+	}
+}
+
+physical_page_metadata_t *
+page_alloc()
+{
+	// fast path: pop a single page from the order 0 free list
+	physical_page_metadata_t *pp = free_lists[ZONE_LOW][0];
+
+	if (pp != NULL)
+	{
+		free_list_remove(pp, 0);
+		nfree_pages--;
+		return pp;
+	}
+
+	// slow path: split a bigger block
+	pp = page_alloc_order(0);
+
+	// panic if out-of-pages
+	if (pp == NULL)
+		panic("page_alloc: out of physical pages");
 
 	// return a pointer to the page's metadata
 	return pp;
@@ -161,17 +845,110 @@ page_alloc()
 
 physical_page_metadata_t *
 page_free(physical_page_metadata_t *pp)
+{
+	return page_free_order(pp, 0);
+}
+
+physical_page_metadata_t *
+page_alloc_order(uint32_t order)
+{
+	return buddy_alloc(ZONE_LOW, order);
+}
+
+physical_page_metadata_t *
+page_alloc_high()
+{
+	physical_page_metadata_t *pp = buddy_alloc(ZONE_HIGH, 0);
+
+	// not every machine has memory above the physmap
+	return pp != NULL ? pp : page_alloc();
+}
+
+// takes a block of 2^order pages from the free lists of zone
+static physical_page_metadata_t *
+buddy_alloc(uint32_t zone, uint32_t order)
+{
+	uint32_t curr;
+
+	if (order > BUDDY_MAX_ORDER)
+		return NULL;
+
+	// top up the free lists before they run dry
+	if (nfree_pages < PAGES_LOW_WATERMARK)
+		pages_deferred_init(PAGES_DEFERRED_BATCH);
+
+	// find the smallest non empty free list that
+	// can service the request, initializing more
+	// chunks of pages[] if none can: high memory
+	// comes last, so only the low zone waits for it
+	do
+	{
+		for (curr = order; curr <= BUDDY_MAX_ORDER; curr++)
+		{
+			if (free_lists[zone][curr] != NULL)
+				break;
+		}
+	} while (curr > BUDDY_MAX_ORDER && zone == ZONE_LOW
+	         && pages_deferred_init(PAGES_DEFERRED_BATCH) > 0);
+	if (curr > BUDDY_MAX_ORDER)
+		return NULL;
+
+	physical_page_metadata_t *pp = free_lists[zone][curr];
+	free_list_remove(pp, curr);
+
+	// split the block in halves untill it has the requested
+	// order, the upper half goes back to the lower free list
+	while (curr > order)
+	{
+		curr--;
+		free_list_push(pp + (1 << curr), curr);
+	}
+
+	pp->order = order;
+	nfree_pages -= (1 << order);
+	return pp;
+}
+
+physical_page_metadata_t *
+page_free_order(physical_page_metadata_t *pp, uint32_t order)
 {
 	// pages can only be freed if
 	// 1) they are NOT kernel pages (flags != PPM_KERNEL)
 	// 2) they have a reference count of 0
-	if (pp->flags != PPM_KERN && pp->ref_count == 0)
+	// 3) they aren't already free
+	if ((pp->flags & (PPM_KERN | PPM_FREE)) || pp->ref_count != 0
+	    || order > BUDDY_MAX_ORDER)
+		return NULL;
+
+	nfree_pages += (1 << order);
+
+	// merge with the buddy block as long as it is free
+	// and of the same order
+	uint32_t idx = pp - pages;
+	while (order < BUDDY_MAX_ORDER)
 	{
-		pp->next = pages_free_list;
-		pages_free_list = pp;
-		return pp;
+		uint32_t buddy_idx = idx ^ (1 << order);
+		if (buddy_idx >= npages)
+			break;
+
+		physical_page_metadata_t *buddy = &pages[buddy_idx];
+		if (!(buddy->flags & PPM_FREE) || buddy->order != order)
+			break;
+
+		free_list_remove(buddy, order);
+		buddy->order = 0;
+		idx &= ~(1 << order);
+		order++;
 	}
-	return NULL;
+
+	free_list_push(&pages[idx], order);
+	return pp;
+}
+
+uint32_t
+page_free_count()
+{
+	return nfree_pages;
 }
 
 pte_t *
@@ -184,6 +961,10 @@ pgdir_walk(pde_t *pgdir, uintptr_t va, int create)
 	// optimistically compute the page table address
 	physaddr_t pt = PTE_ADDR(pgdir[pdx]);
 
+	// 4 MB pages have no page table
+	if ((pgdir[pdx] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+		return NULL;
+
 	// if no page table exists for the provided page directory index
 	if (!(pgdir[pdx] & PTE_P))
 	{
@@ -197,20 +978,29 @@ pgdir_walk(pde_t *pgdir, uintptr_t va, int create)
 		// address space otherwise any call of this function that
 		// triggered page_alloc() will page fault SOLUTION: apparently
 		// recursive mapping solves it
-		physical_page_metadata_t *pp = page_alloc();
-		serial_printf("[DEBUG] pgdir_walk allocated pa %x\n",
-		              page2pa(pp));
-
-		// get the physical address of pp
-		pt = PTE_ADDR(page2pa(pp));
+		// while pages[] is being built frames come from boot_alloc(),
+		// which hands out uninitialized memory
+		// afterwards a pre-zeroed frame is taken from the pool
+		physical_page_metadata_t *pp = NULL;
+		if (!pages_ready)
+			pt = early_frame_alloc();
+		else if ((pp = zero_pool_get()) != NULL)
+			pt = page2pa(pp);
+		else
+			pt = PTE_ADDR(page2pa(page_alloc()));
+		serial_printf("[DEBUG] pgdir_walk allocated pa %x\n", pt);
 
 		// update the page directory
 		pgdir[pdx] = pt | PTE_P | PTE_U | PTE_W;
+
+		// a pool miss: clear the table right away
+		if (pp == NULL)
+			memset(pgtable_kva(pgdir, pdx), 0, PGSIZE);
 	}
 
-	// recursively mapped virtual address
-	// to access the page directory at pdx
-	pte_t *pt_va = PT_VADDR(pdx);
+	// kernel virtual address to
+	// access the page table at pdx
+	pte_t *pt_va = pgtable_kva(pgdir, pdx);
 	// return the actual PTE address
 	return &pt_va[ptx];
 }
@@ -218,30 +1008,24 @@ pgdir_walk(pde_t *pgdir, uintptr_t va, int create)
 physaddr_t
 va_to_pa(pde_t *pgdir, uintptr_t va)
 {
+	// large pages are translated by the page directory entry itself
+	pde_t pde = pgdir[PDX(va)];
+	if ((pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+		return (physaddr_t)(LGPTE_ADDR(pde) | LGPGOFFSET(va));
+
 	// extract the page table without creating if not mapped
 	pte_t *pte = pgdir_walk(pgdir, va, 0);
 	// if pte is NULL it means that va is not mapped
 	if (pte == NULL)
-		return NULL;
-	// if the present bit is set then add the offset otherwise NULL
-	return (physaddr_t)(*pte & PTE_P ? PTE_ADDR(*pte) | PGOFFSET(va) : NULL);
+		return 0;
+	// if the present bit is set then add the offset otherwise 0
+	return (physaddr_t)(*pte & PTE_P ? PTE_ADDR(*pte) | PGOFFSET(va) : 0);
 }
 
 void
 map_va(pde_t *pgdir, uintptr_t va, physaddr_t pa)
 {
-	// round down both addresses to the nearest page
-	va = PGROUNDDOWN(va);
-	pa = PGROUNDDOWN(pa);
-	// fetch pte for va
-	pte_t *pte = pgdir_walk(pgdir, va, 1);
-	// return early on error
-	if (pte == NULL)
-		return;
-	// update the PTE
-	*pte = PTE_ADDR(pa) | PTE_P | PTE_W;
-
-	// serial_printf("va: %x pa: %x -> pte: %x\n", va, pa, pte);
+	map_range(pgdir, va, pa, 1, PTE_W);
 }
 
 /// maps the given physical page to va
@@ -251,58 +1035,290 @@ map_pp(pde_t *pgdir, physical_page_metadata_t *pp, uintptr_t va)
 	map_va(pgdir, va, page2pa(pp));
 }
 
-// TODO: test this function
+int
+map_large(pde_t *pgdir, uintptr_t va, physaddr_t pa)
+{
+	if (!pse_enabled || LGPGOFFSET(va) != 0 || LGPGOFFSET(pa) != 0)
+		return -1;
+
+	// a single store, so that it is also safe to replace
+	// the page table of the code that is running
+	pde_t old = pgdir[PDX(va)];
+	pgdir[PDX(va)] = pa | PTE_P | PTE_W | PTE_PS
+	                 | (va >= KERN_BASE_VRT ? pte_global : 0);
+
+	// stale 4 KB translations of the old page table,
+	// which may be global
+	if (old & PTE_P)
+		tlbflush_global();
+	return 0;
+}
+
 // removes the mapping of va from pgdir
 void
 unmap_va(pde_t *pgdir, uintptr_t va)
 {
-	// round down va to the nearest page
-	va = PGROUNDDOWN(va);
-	// try to get va's PTE
-	pte_t *pte = pgdir_walk(pgdir, va, 0);
-	// if pte == NULL va is not mapped
-	// so we return early
-	if (pte == NULL)
+	unmap_range(pgdir, va, 1);
+}
+
+// returns a kernel virtual address to access the page table at
+// pgdir[pdx]: through the physmap once it exists, so that any page
+// directory can be edited, through the recursive mapping of the
+// current one before that
+static inline pte_t *
+pgtable_kva(pde_t *pgdir, uint32_t pdx)
+{
+	if (physmap_ready)
+		return (pte_t *)pa2kva(PTE_ADDR(pgdir[pdx]));
+	return PT_VADDR(pdx);
+}
+
+// returns the metadata of the page table at pgdir[pdx], whose
+// ref_count is the number of present entries in the table
+static inline physical_page_metadata_t *
+pgtable_pp(pde_t *pgdir, uint32_t pdx)
+{
+	return pa2pp(PTE_ADDR(pgdir[pdx]));
+}
+
+// invalidates the TLB entries of npages pages starting at va:
+// one invlpg per page for small ranges, a CR3 reload otherwise
+// (or a full flush for the kernel half, where entries are global)
+static void
+tlb_flush_range(uintptr_t va, uint32_t npages)
+{
+	if (npages > TLB_FLUSH_THRESHOLD)
+	{
+		if (va >= KERN_BASE_VRT && pte_global)
+			tlbflush_global();
+		else
+			tlbflush();
 		return;
+	}
+	for (uint32_t i = 0; i < npages; i++, va += PGSIZE)
+		invlpg((void *)va);
+}
+
+int
+map_range(pde_t *pgdir, uintptr_t va, physaddr_t pa, uint32_t npages,
+          uint32_t flags)
+{
+	uintptr_t start = PGROUNDDOWN(va);
+	uint32_t left = npages, stale = 0;
 
-	// remove va's mapping
-	*pte = 0;
+	// round down both addresses to the nearest page
+	va = start;
+	pa = PGROUNDDOWN(pa);
 
-	// extract the page directory index
-	// from va -> needed for PT_VADDR
-	uint32_t pdx = PDX(va);
+	// kernel half mappings are global
+	if (va >= KERN_BASE_VRT)
+		flags |= pte_global;
 
-	pte_t *pgtable = PT_VADDR(pdx);
-	// check if the entire page table of va
-	// is empty
-	for (uint32_t ptx = 0; ptx < 1024; ptx++)
+	while (left > 0)
 	{
-		if (pgtable[ptx] & PTE_P)
+		// walk the page directory once per page table
+		pte_t *pte = pgdir_walk(pgdir, va, 1);
+		// give up on error (va is inside a large page)
+		if (pte == NULL)
+			break;
+
+		// fill the consecutive entries of this page table
+		uint32_t pdx = PDX(va);
+		uint32_t n = NPTENTRIES - PTX(va);
+		if (n > left)
+			n = left;
+		uint32_t added = 0;
+		for (uint32_t i = 0; i < n; i++, va += PGSIZE, pa += PGSIZE)
 		{
-			// if at least one page is present
-			// we're done since we can't
-			// free the page directory
-			serial_printf(
-			    "[LOG] unmap_va() DONE without page_free()\n");
-			return;
+			if (pte[i] & PTE_P)
+				stale = 1;
+			else
+				added++;
+			pte[i] = PTE_ADDR(pa) | PTE_FLAGS(flags) | PTE_P;
 		}
+		left -= n;
+
+		// keep the present count of the page table, tables made
+		// before pages[] existed are counted by pgtables_count()
+		if (pages_ready)
+			pgtable_pp(pgdir, pdx)->ref_count += added;
 	}
 
-	// if the for loop completed the
-	// page directory is completely
-	// empty and thus can be freed
-	physaddr_t pgtable_phys = PTE_ADDR(pgdir[pdx]);
-	serial_printf("pgtablephys: %x\n", pgtable_phys);
-	pgdir[pdx] = 0;
-	page_free(pa2pp(pgtable_phys));
-	tlbflush();
+	// only replaced mappings can be cached in the TLB
+	if (stale)
+		tlb_flush_range(start, npages - left);
+	return left == 0 ? 0 : -1;
+}
+
+void
+unmap_range(pde_t *pgdir, uintptr_t va, uint32_t npages)
+{
+	uintptr_t start = PGROUNDDOWN(va);
+	uint32_t left = npages, pt_freed = 0;
+
+	// round down va to the nearest page
+	va = start;
+
+	while (left > 0)
+	{
+		uint32_t pdx = PDX(va);
+		uint32_t n = NPTENTRIES - PTX(va);
+		if (n > left)
+			n = left;
+
+		// if pte == NULL this part of the range
+		// isn't mapped so we skip the whole table
+		pte_t *pte = pgdir_walk(pgdir, va, 0);
+		if (pte != NULL)
+		{
+			// remove the mappings
+			uint32_t removed = 0;
+			for (uint32_t i = 0; i < n; i++)
+			{
+				if (pte[i] & PTE_P)
+					removed++;
+				pte[i] = 0;
+			}
+
+			// the page table is completely empty
+			// as soon as its present count drops
+			// to 0 and thus can be freed, unless
+			// it was allocated at boot: page_free()
+			// refuses PPM_KERN frames, so the empty
+			// table stays in place to be reused
+			physical_page_metadata_t *pt_pp = pgtable_pp(pgdir, pdx);
+			pt_pp->ref_count -= removed;
+			if (pt_pp->ref_count == 0 && !(pt_pp->flags & PPM_KERN))
+			{
+				pgdir[pdx] = 0;
+				page_free(pt_pp);
+				// its recursive mapping may be cached as well
+				invlpg(PT_VADDR(pdx));
+				pt_freed++;
+			}
+		}
+
+		va += n * PGSIZE;
+		left -= n;
+	}
+
+	tlb_flush_range(start, npages);
+	if (pt_freed)
+		serial_printf("[LOG] unmap_range() freed %d page tables\n",
+		              pt_freed);
+}
+
+int
+vm_page_fault(uintptr_t va, uint32_t error_code)
+{
+	uint64_t tsc = read_tsc();
+	uint32_t *counter;
+
+	// only kernel accesses to pages that aren't mapped yet can
+	// be served, anything else is a bug of the faulting code
+	if (error_code & (FEC_PR | FEC_U))
+		counter = NULL;
+	else if (va >= KHEAP_BASE && va <= kheap_end)
+		counter = &vm_faults.heap;
+	else if (va >= VMALLOC_BASE && va < VMALLOC_END
+	         && vmalloc_contains(va))
+		counter = &vm_faults.vmalloc;
+	else
+		counter = NULL;
+
+	if (counter == NULL)
+	{
+		vm_faults.bad++;
+		return -1;
+	}
+
+	// take an already cleared frame, on a pool miss
+	// clear a (preferably high memory) frame in place
+	va = PGROUNDDOWN(va);
+	physical_page_metadata_t *pp = zero_pool_get();
+	if (pp != NULL)
+		map_pp(kern_pgdir, pp, va);
+	else
+	{
+		map_pp(kern_pgdir, page_alloc_high(), va);
+		memset((void *)va, 0, PGSIZE);
+	}
+
+	(*counter)++;
+	uint32_t cycles = read_tsc() - tsc;
+	vm_faults.cycles += cycles;
+	if (cycles > vm_faults.max_cycles)
+		vm_faults.max_cycles = cycles;
+	return 0;
+}
+
+void
+vm_fault_stats(vm_fault_stats_t *stats)
+{
+	*stats = vm_faults;
+}
+
+void *
+kmap(physical_page_metadata_t *pp)
+{
+	// low memory is always mapped
+	if (page_zone(pp) == ZONE_LOW)
+		return pp2kva(pp);
+
+	uint32_t eflags = read_eflags();
+	cli();
+	for (uint32_t i = 0; i < KMAP_SLOTS / 32; i++)
+	{
+		if (kmap_used[i] == 0xFFFFFFFF)
+			continue;
+
+		uint32_t slot = i * 32 + __builtin_ctz(~kmap_used[i]);
+		kmap_used[i] |= 1u << (slot % 32);
+		// kunmap() already dropped the old translation
+		kmap_ptes[slot] = page2pa(pp) | PTE_P | PTE_W | pte_global;
+		write_eflags(eflags);
+		return (void *)(uintptr_t)(KMAP_BASE + (slot << PTXSHIFT));
+	}
+	write_eflags(eflags);
+
+	panic("kmap: out of slots");
+	return NULL;
+}
+
+void
+kunmap(void *va)
+{
+	// physmap addresses have nothing to release
+	if ((uintptr_t)va < KMAP_BASE)
+		return;
+
+	uint32_t slot = ((uintptr_t)va - KMAP_BASE) >> PTXSHIFT;
+	uint32_t eflags = read_eflags();
+	cli();
+	kmap_ptes[slot] = 0;
+	invlpg((void *)PGROUNDDOWN((uintptr_t)va));
+	kmap_used[slot / 32] &= ~(1u << (slot % 32));
+	write_eflags(eflags);
+}
+
+void
+unmap_range_free(pde_t *pgdir, uintptr_t va, uint32_t npages)
+{
+	// the range is dead so nobody accesses the frames until
+	// unmap_range() drops the mappings with a single TLB flush
+	for (uint32_t i = 0; i < npages; i++)
+	{
+		physaddr_t pa = va_to_pa(pgdir, va + i * PGSIZE);
+		if (pa)
+			page_free(pa2pp(pa));
+	}
+	unmap_range(pgdir, va, npages);
 }
 
 // debugging utility that dumps the content
 // of a given page table over UART
 // NOTE: pgdir will be always mapped in kernel virtual address space
-// but this is not true for the page tables, for which recursive
-// mapping will be used
+// and so are the page tables, through the physmap
 void
 dbg_dump_pgdir(pde_t *pgdir, const char *pgdir_name)
 {
@@ -315,16 +1331,21 @@ dbg_dump_pgdir(pde_t *pgdir, const char *pgdir_name)
 		// at current pdx
 		pde_t pde = pgdir[pdx];
 
+		// large pages have no page table to dump
+		if ((pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+		{
+			serial_printf("PDE[%d] -> VA %x -> 4MB PA %x\n", pdx,
+			              pdx << PDXSHIFT, LGPTE_ADDR(pde));
+		}
 		// check if present
-		if (pde & PTE_P)
+		else if (pde & PTE_P)
 		{
 			// extract ONLY the physical address
 			// from the page directory entry
 			// by masking out the flags
 			uint32_t pt_phys = pde & 0xFFFFF000;
 			// convert it to a kernel virtual address
-			// using recursive mapping
-			pte_t *pgtable = PT_VADDR(pdx);
+			pte_t *pgtable = pgtable_kva(pgdir, pdx);
 
 			serial_printf("PDE[%d] -> PT@%x\n", pdx, pt_phys);
 
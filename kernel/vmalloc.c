@@ -0,0 +1,146 @@
+#include <learnix/drivers/serial.h>
+#include <learnix/vm.h>
+#include <learnix/vmalloc.h>
+#include <learnix/x86/mmu.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// live areas sorted by address
+static vm_area_t vmalloc_areas[VMALLOC_MAX_AREAS];
+static uint32_t nvmalloc_areas;
+
+// reserves npages in the first hole big enough for
+// them and a guard page, returns 0 if the window is full
+static uintptr_t
+vm_area_add(uint32_t npages, uint32_t flags)
+{
+	uintptr_t va = VMALLOC_BASE;
+	uint32_t i;
+
+	if (npages == 0 || nvmalloc_areas == VMALLOC_MAX_AREAS
+	    || npages >= (VMALLOC_END - VMALLOC_BASE) >> PTXSHIFT)
+		return 0;
+
+	// first fit: look for a hole big enough
+	// for the area and its guard page
+	for (i = 0; i < nvmalloc_areas; i++)
+	{
+		if ((vmalloc_areas[i].start - va) >> PTXSHIFT > npages)
+			break;
+		va = vmalloc_areas[i].start
+		     + ((vmalloc_areas[i].npages + 1) << PTXSHIFT);
+	}
+	if ((VMALLOC_END - va) >> PTXSHIFT <= npages)
+		return 0;
+
+	for (uint32_t j = nvmalloc_areas; j > i; j--)
+		vmalloc_areas[j] = vmalloc_areas[j - 1];
+	vmalloc_areas[i].start = va;
+	vmalloc_areas[i].npages = npages;
+	vmalloc_areas[i].flags = flags;
+	nvmalloc_areas++;
+
+	return va;
+}
+
+// returns the index of the area starting at va, -1 if there's none
+static int
+vm_area_find(uintptr_t va)
+{
+	for (uint32_t i = 0; i < nvmalloc_areas; i++)
+	{
+		if (vmalloc_areas[i].start == va)
+			return i;
+	}
+	return -1;
+}
+
+static void
+vm_area_remove(uint32_t i)
+{
+	for (; i + 1 < nvmalloc_areas; i++)
+		vmalloc_areas[i] = vmalloc_areas[i + 1];
+	nvmalloc_areas--;
+}
+
+void *
+vmalloc(uint32_t size)
+{
+	// nothing gets mapped here: the page fault
+	// handler backs the area one page at a time
+	uintptr_t va = vm_area_add(PGROUNDUP(size) >> PTXSHIFT, 0);
+
+	return va ? (void *)va : NULL;
+}
+
+void
+vfree(void *addr)
+{
+	int i = vm_area_find((uintptr_t)addr);
+
+	if (i < 0 || (vmalloc_areas[i].flags & VM_IOREMAP))
+	{
+		serial_printf("[LOG] vfree: %x is not a vmalloc area\n", addr);
+		return;
+	}
+
+	// give back the frames that were faulted in
+	unmap_range_free(kern_pgdir, vmalloc_areas[i].start,
+	                 vmalloc_areas[i].npages);
+	vm_area_remove(i);
+}
+
+void *
+ioremap(physaddr_t pa, uint32_t size)
+{
+	uint32_t offset = pa & (PGSIZE - 1);
+	uint32_t npages = PGROUNDUP(offset + size) >> PTXSHIFT;
+	uintptr_t va = vm_area_add(npages, VM_IOREMAP);
+
+	if (va == 0)
+		return NULL;
+
+	// device registers must not be cached nor
+	// written back out of order
+	if (map_range(kern_pgdir, va, pa, npages, PTE_W | PTE_PCD | PTE_PWT) < 0)
+	{
+		// drop the pages mapped before the failure
+		unmap_range(kern_pgdir, va, npages);
+		vm_area_remove(vm_area_find(va));
+		return NULL;
+	}
+	return (void *)(va + offset);
+}
+
+void
+iounmap(void *addr)
+{
+	int i = vm_area_find(PGROUNDDOWN((uintptr_t)addr));
+
+	if (i < 0 || !(vmalloc_areas[i].flags & VM_IOREMAP))
+	{
+		serial_printf("[LOG] iounmap: %x is not an ioremap area\n", addr);
+		return;
+	}
+
+	// the frames aren't RAM of the page allocator
+	unmap_range(kern_pgdir, vmalloc_areas[i].start, vmalloc_areas[i].npages);
+	vm_area_remove(i);
+}
+
+int
+vmalloc_contains(uintptr_t va)
+{
+	for (uint32_t i = 0; i < nvmalloc_areas; i++)
+	{
+		// ioremap() areas are always mapped, and
+		// the guard page isn't part of the area
+		if (vmalloc_areas[i].flags & VM_IOREMAP)
+			continue;
+		if (va >= vmalloc_areas[i].start
+		    && (va - vmalloc_areas[i].start) >> PTXSHIFT
+		           < vmalloc_areas[i].npages)
+			return 1;
+	}
+	return 0;
+}
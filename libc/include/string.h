@@ -13,4 +13,16 @@ void *memset(void *ptr, int value, uint32_t num);
 
 uint32_t strlen(const char*);
 
+#if defined(__is_libk)
+// implementations picked by cpu_features_init(),
+// memcpy() and memset() call through these
+void* memcpy_erms(void* restrict dst, const void* restrict src, uint32_t size);
+void* memcpy_movsl(void* restrict dst, const void* restrict src, uint32_t size);
+extern void* (*memcpy_impl)(void* restrict, const void* restrict, uint32_t);
+
+void* memset_erms(void* ptr, int value, uint32_t num);
+void* memset_stosl(void* ptr, int value, uint32_t num);
+extern void* (*memset_impl)(void*, int, uint32_t);
+#endif
+
 #endif
\ No newline at end of file
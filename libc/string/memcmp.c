@@ -0,0 +1,14 @@
+#include <string.h>
+
+int
+memcmp(const void *a, const void *b, uint32_t size)
+{
+	const uint8_t *x = a, *y = b;
+
+	for (uint32_t i = 0; i < size; i++)
+	{
+		if (x[i] != y[i])
+			return x[i] < y[i] ? -1 : 1;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -8,12 +8,44 @@
     rep simply repeates the following instruction as specified in the ECX
    register
 */
+
+// with ERMS the microcode moves whole cache lines
+// for rep movsb, whatever the size and alignment
 void *
-memcpy(void *restrict dst, const void *restrict src, uint32_t size)
+memcpy_erms(void *restrict dst, const void *restrict src, uint32_t size)
 {
+	void *d = dst;
+
 	asm volatile("rep movsb"
-	             : "+D"(dst), "+S"(src), "+c"(size)
+	             : "+D"(d), "+S"(src), "+c"(size)
 	             :
 	             : "memory");
 	return dst;
-}
\ No newline at end of file
+}
+
+// without ERMS rep movsl moves 4 bytes per iteration,
+// rep movsb copies the last 0 to 3
+void *
+memcpy_movsl(void *restrict dst, const void *restrict src, uint32_t size)
+{
+	void *d = dst;
+	uint32_t tail = size & 3;
+
+	size >>= 2;
+	asm volatile("rep movsl\n\t"
+	             "movl %3, %%ecx\n\t"
+	             "rep movsb"
+	             : "+D"(d), "+S"(src), "+c"(size)
+	             : "r"(tail)
+	             : "memory");
+	return dst;
+}
+
+void *(*memcpy_impl)(void *restrict, const void *restrict, uint32_t)
+    = memcpy_movsl;
+
+void *
+memcpy(void *restrict dst, const void *restrict src, uint32_t size)
+{
+	return memcpy_impl(dst, src, size);
+}
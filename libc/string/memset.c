@@ -4,10 +4,43 @@
  * stobs is an x86 specific-instruction that enables hardware-optimized memory
  * filling
  */
+
+// with ERMS rep stosb is as fast as the wider stores
 void *
-memset(void *ptr, int value, uint32_t num)
+memset_erms(void *ptr, int value, uint32_t num)
+{
+	void *p = ptr;
+
+	asm volatile("cld; rep stosb\n"
+	             : "+D"(p), "+c"(num)
+	             : "a"(value)
+	             : "cc", "memory");
+	return ptr;
+}
+
+// without ERMS rep stosl stores the byte 4 times
+// per iteration, rep stosb stores the last 0 to 3
+void *
+memset_stosl(void *ptr, int value, uint32_t num)
 {
-	asm volatile("cld; rep stosb\n" ::"D"(ptr), "a"(value), "c"(num)
+	void *p = ptr;
+	uint32_t fill = (uint8_t)value * 0x01010101u;
+	uint32_t tail = num & 3;
+
+	num >>= 2;
+	asm volatile("cld; rep stosl\n\t"
+	             "movl %3, %%ecx\n\t"
+	             "rep stosb"
+	             : "+D"(p), "+c"(num)
+	             : "a"(fill), "r"(tail)
 	             : "cc", "memory");
 	return ptr;
-}
\ No newline at end of file
+}
+
+void *(*memset_impl)(void *, int, uint32_t) = memset_stosl;
+
+void *
+memset(void *ptr, int value, uint32_t num)
+{
+	return memset_impl(ptr, value, num);
+}